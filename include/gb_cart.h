@@ -4,6 +4,7 @@
 #include <fstream>
 
 class MBC;
+class Snapshot;
 
 class Cartridge
 {
@@ -12,15 +13,21 @@ class Cartridge
         ~Cartridge();
         unsigned char read_byte(unsigned short address);
         void write_byte(unsigned short address, unsigned char value);
+        unsigned short get_rom_bank(void);
         unsigned char *cart_rom, *cart_ram;
         void export_sav(std::string sav_path);
         void import_sav(std::string path);
+        // saves or restores cart RAM and MBC registers (see gb_state.h)
+        void state(Snapshot &s);
+        // FNV-1a of the whole ROM file. tells save states of other ROMs apart
+        unsigned int rom_checksum;
 
         bool loaded;
     private:
         MBC *mbc;
 
         unsigned short num_ram_banks;
+        unsigned int ram_size;
 
 
         /* constants */
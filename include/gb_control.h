@@ -0,0 +1,96 @@
+#pragma once
+#include "gbcon.h"
+#include <string>
+#include <vector>
+
+class SaveState;
+
+/* Control server (--control PATH): programs drive the emulator over a Unix
+   domain socket instead of typing into the debugger prompt. Every client
+   that connects gets a session of its own, starting at power on with the
+   ROM loaded. Sessions are forked from the server process (the components
+   are process wide), so they run in parallel on separate cores and one
+   client can't stall or disturb another. The server itself only accepts
+   connections and never waits on a client.
+
+   Protocol. Everything is little endian. A client sends a batch, which is
+   a u32 byte count followed by that many bytes of commands. The session
+   runs them in order and answers with one batch holding a result for each:
+   a status byte, then the command's data if it was OK. A failed command
+   ends the batch, so its result is the last one.
+
+     op    command            arguments             data returned
+     0x01  Ctl_Step           u32 frames            u64 frame, u64 cycle
+     0x02  Ctl_Input          u8 buttons, u8 dir    -
+     0x03  Ctl_Read           u16 address, u16 len  len bytes
+     0x04  Ctl_Write          u16 address, u16 len, -
+                              len bytes
+     0x05  Ctl_Save           -                     u32 len, len bytes
+     0x06  Ctl_Load           u32 len, len bytes    -
+     0x07  Ctl_Frame          -                     160*144 shades (0-3)
+
+   Step runs whole frames and reports the frame number and clock it stopped
+   at (Step 0 just reports them). Input holds keys from the current clock
+   on, with bits as in gb_joypad.h. Reads don't trigger watchpoints, and
+   writes go through the bus like a CPU write would. Save returns the whole
+   machine state (see gb_state.h), which Load takes back in this or another
+   session of the same ROM. Load refuses states of other ROMs or state
+   versions. Frame returns the last frame drawn.
+ */
+
+enum Control_Op : unsigned char {
+  Ctl_Step = 0x01,
+  Ctl_Input = 0x02,
+  Ctl_Read = 0x03,
+  Ctl_Write = 0x04,
+  Ctl_Save = 0x05,
+  Ctl_Load = 0x06,
+  Ctl_Frame = 0x07,
+};
+
+enum Control_Status : unsigned char {
+  Ctl_Ok = 0,
+  // unknown op, or arguments cut off by the end of the batch
+  Ctl_Bad_Command = 1,
+  // a read or write past 0xFFFF
+  Ctl_Bad_Range = 2,
+  // a state that isn't one of this ROM's. the machine is left as it was
+  Ctl_Bad_State = 3,
+  // the CPU stopped (STOP, or an illegal opcode) and can't run frames
+  Ctl_Stopped = 4,
+};
+
+class ControlServer {
+public:
+  // the largest batch a session takes, in bytes
+  static const unsigned int Max_Batch = 1 << 20;
+  // sessions running at once. clients past this are turned away
+  static const unsigned int Max_Sessions = 64;
+
+  ~ControlServer();
+  // false (with a message) if the socket can't be created
+  bool open(const std::string &path);
+  // serves until SIGINT or SIGTERM. run_frame emulates a frame
+  void run(GB_Sys *gb_sys, SaveState *save_state, bool (*run_frame)(void));
+  void close(void);
+
+private:
+  std::string path;
+  int listen_fd = -1;
+  unsigned int sessions = 0;
+  void reap(void);
+
+  /* a session, in its own process
+   */
+
+  GB_Sys sys;
+  SaveState *save_state;
+  bool (*run_frame)(void);
+  void serve(int fd);
+  // appends a result to reply for each command run
+  void run_batch(const unsigned char *in, size_t len,
+                 std::vector<unsigned char> &reply);
+  Control_Status run_command(const unsigned char *&in,
+                             const unsigned char *end,
+                             std::vector<unsigned char> &reply);
+};
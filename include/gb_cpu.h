@@ -8,6 +8,8 @@
 #include <boost/circular_buffer.hpp>
 #include "gbcon.h"
 
+class TraceWriter;
+
 class CPU {
 public:
   unsigned int ticks = 0;                               // instrs exec'd
@@ -634,10 +636,37 @@ public:
   };
 
   void init(GB_Sys *gb_sys);
+  // saves or restores registers and run state (see gb_state.h)
+  void state(Snapshot &s);
 
   unsigned char curr_inst;
   unsigned short prev_pc;
 
+  /* execution trace. always on. keeps the last Trace_Length instructions so
+     they can be dumped on a breakpoint, bad opcode, bad memory access or a
+     crash
+   */
+
+  struct Trace_Record {
+    unsigned long cycle; // machine_cycle_counter before the instruction
+    unsigned short pc;
+    unsigned short bank; // rom bank mapped at 0x4000-0x7fff if pc is there
+    unsigned short af, bc, de, hl, sp;
+    unsigned char opcode;
+  };
+  static const size_t Trace_Length = 256;
+  boost::circular_buffer<Trace_Record> trace_ring{Trace_Length};
+  // off while run-ahead frames are being thrown away, so dumps only show
+  // instructions the real machine ran
+  bool trace_ring_on = true;
+
+  void dump_trace(std::ostream &out, size_t count = Trace_Length);
+  // async-signal-safe version for crash handlers
+  void dump_trace_fd(int fd);
+
+  // full binary state trace for diffing against other emulators (--cpu-trace)
+  TraceWriter *trace_writer = nullptr;
+
 
 private:
   /* GB system (pointers to other components)
@@ -645,5 +674,7 @@ private:
 
   Memory *mem;
   Interrupt *interrupt;
+  Cartridge *cart;
 
+  int format_trace_record(char *buf, size_t len, const Trace_Record &t);
 };
@@ -1,38 +1,64 @@
+#pragma once
 #include "gb_cpu.h"
+#include "gb_dbg_expr.h"
 #include "gbcon.h"
 #include <vector>
 #include <string>
 #include <functional>
 #include <map>
+#include <bitset>
 
 class Debug {
 public:
   void run(void);
   void init(GB_Sys *gb_sys);
 
-  void write_serial_log_file(std::string filepath);
   bool stopped;
 
+  // set when the debugger must run before the next instruction (step
+  // request, watchpoint hit, stopped at prompt). breakpoints are checked
+  // against break_traps directly by the main loop
+  bool attention = false;
+  std::bitset<0x10000> break_traps;
+
+  // called from the memory bus when a trapped address is accessed
+  void read_trap(unsigned short addr);
+  void write_trap(unsigned short addr, unsigned char value);
+
 private:
   // pointers to other components
   CPU *cpu;
   Memory *mem;
 
+  enum Watch_Type {
+    WATCH_READ   = 1 << 0,
+    WATCH_WRITE  = 1 << 1,
+    WATCH_CHANGE = 1 << 2, // write that modifies the value
+  };
   struct Watchpoint {
-    unsigned short addr;
-    unsigned char prev_val;
+    unsigned short start_addr;
+    unsigned short end_addr; // inclusive
+    unsigned char type;
     bool enabled;
   };
   struct Breakpoint {
 //  unsigned short addr;
     bool enabled;
+    DebugExpr cond; // empty if unconditional
+  };
+  // logs an expression when hit without stopping
+  struct Tracepoint {
+    DebugExpr expr;
+    DebugExpr cond;
   };
 
-  bool check_watchpoints(void);
   bool check_breakpoints(void);
+  void update_watch_traps(void);
+  void print_watchpoint(size_t index);
 
   std::map<unsigned short, Breakpoint> breakpoints;
-  std::map<unsigned short, Watchpoint> watchpoints;
+  std::map<unsigned short, Tracepoint> tracepoints;
+  std::vector<Watchpoint> watchpoints;
 
   // Debug Command Handlers
 
@@ -41,10 +67,13 @@ private:
   typedef std::vector<std::string> CmdArgs;
   void execute_help_cmd(CmdArgs &argv);
   void execute_break_cmd(CmdArgs &argv);
+  void execute_trace_cmd(CmdArgs &argv);
   void execute_watch_cmd(CmdArgs &argv);
+  void execute_unwatch_cmd(CmdArgs &argv);
   void execute_continue_cmd(CmdArgs &argv);
   void execute_step_cmd(CmdArgs &argv);
   void execute_examine_cmd(CmdArgs &argv);
+  void execute_last_cmd(CmdArgs &argv);
   void execute_info_cmd(CmdArgs &argv);
   void execute_reset_cmd(CmdArgs &argv);
   void execute_quit_cmd(CmdArgs &argv);
@@ -63,6 +92,7 @@ private:
   bool step_resume = false;
   // width used to print help commands
   const int PrintWidth = 16;
+  // instructions from the trace ring shown when a breakpoint hits
+  const size_t Trace_Lines_On_Break = 16;
 
-  std::vector<char> serial_data;
 };
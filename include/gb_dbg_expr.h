@@ -0,0 +1,61 @@
+#pragma once
+#include "gbcon.h"
+#include <string>
+#include <vector>
+
+/* Debugger expressions. e.g.
+     a==0x3 && [0xff44]>=0x90
+   parsed once into a small stack bytecode so conditional breakpoints and
+   tracepoints are cheap to evaluate each time their address is hit.
+
+   operands:  numbers (0x.. or decimal), registers a f b c d e h l af bc de hl
+              sp pc, flags zf nf hf cf, memory bytes [expr]
+   operators: () ! ~ - + & ^ | == != < <= > >= && ||  (C precedence)
+*/
+class DebugExpr {
+public:
+  // throws std::invalid_argument on a syntax error
+  void compile(const std::string &text);
+  int eval(CPU *cpu, Memory *mem) const;
+
+  bool empty(void) const { return code.empty(); }
+  std::string text;
+
+private:
+  enum Op : unsigned char {
+    PUSH_IMM, PUSH_REG, PUSH_FLAG, LOAD_MEM,
+    NOT, BIT_NOT, NEG,
+    ADD, SUB, AND, XOR, OR,
+    EQ, NE, LT, LE, GT, GE,
+    LOG_AND, LOG_OR,
+  };
+  struct Inst {
+    Op op;
+    unsigned short arg;
+  };
+  std::vector<Inst> code;
+
+  // deepest the eval stack can get. checked at compile time
+  static const int Max_Stack = 16;
+
+  /* recursive descent parser state
+   */
+
+  std::vector<std::string> tokens;
+  size_t pos;
+  int depth, max_depth;
+
+  void tokenize(const std::string &s);
+  bool accept(const char *tok);
+  void emit(Op op, unsigned short arg = 0);
+
+  void parse_log_or(void);
+  void parse_log_and(void);
+  void parse_compare(void);
+  void parse_bit_or(void);
+  void parse_bit_xor(void);
+  void parse_bit_and(void);
+  void parse_sum(void);
+  void parse_unary(void);
+  void parse_primary(void);
+};
@@ -7,6 +7,8 @@
 class Interrupt {
 public:
   void init(GB_Sys *gb_sys);
+  // saves or restores IF, IE and IME (see gb_state.h)
+  void state(Snapshot &s);
 
   enum interrupts {
     VBLANK = 1 << 0,    // Bit 0
@@ -0,0 +1,111 @@
+#pragma once
+#include "gbcon.h"
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+// held keys, read back through 0xFF00. bits are set while a key is held
+extern unsigned char buttons;   // a, b, select, start (bits 0-3)
+extern unsigned char direction; // right, left, up, down (bits 0-3)
+
+// held keys changed, as seen by the host
+struct Input_Change {
+  std::chrono::steady_clock::time_point time;
+  unsigned char buttons, direction;
+};
+
+/* Joypad input on the emulated clock. Every key change is queued with the
+   cycle it takes effect at and applied when the core gets there, raising
+   the HI_LO interrupt for newly pressed keys on a selected line.
+
+   Host key changes are only seen once per frame, so schedule_frame places
+   the ones from the frame that just went by at the same points of the next
+   one. Presses keep their timing within the frame and a press and release
+   inside one frame both reach the game. Applied changes can be recorded in
+   the InputScript format and played back cycle for cycle.
+ */
+class Joypad {
+public:
+  ~Joypad();
+  void init(GB_Sys *gb_sys);
+  // saves or restores held keys and queued changes (see gb_state.h)
+  void state(Snapshot &s);
+
+  // held keys from cycle on (clocks since power on, see LCD::cycle)
+  void schedule(unsigned long long cycle, unsigned char buttons,
+                unsigned char direction);
+  // changes seen between host_start and host_end go to the same fraction
+  // of the frame starting at frame_start
+  void schedule_frame(const std::vector<Input_Change> &changes,
+                      unsigned long long frame_start,
+                      std::chrono::steady_clock::time_point host_start,
+                      std::chrono::steady_clock::time_point host_end);
+
+  // apply changes due by cycle
+  void step(unsigned long long cycle) {
+    if (cycle >= next_cycle) {
+      apply(cycle);
+    }
+  }
+  // cycle of the next queued change
+  unsigned long long next_cycle = ULLONG_MAX;
+
+  // writes applied changes to path as an input script
+  bool record(const std::string &path);
+  // ends the recording with a quit at this frame, so replays stop there too
+  void close(unsigned long frames);
+  // off while run-ahead frames are being thrown away
+  bool recording = true;
+
+private:
+  struct Pending {
+    unsigned long long cycle;
+    unsigned char buttons, direction;
+  };
+  // in cycle order
+  std::deque<Pending> queue;
+  void apply(unsigned long long cycle);
+
+  FILE *record_file = nullptr;
+
+  /* GB system (pointers to other components)
+   */
+
+  Memory *mem;
+  Interrupt *interrupt;
+};
+
+/* Input script, for headless runs and replaying a --record-input file. Each
+   line is a frame number, optionally :clock within the frame, and the keys
+   held from then on, replacing the ones before:
+
+     # comment
+     60 start
+     70:1234 a right
+     90 none
+     600 quit
+
+   keys are up, down, left, right, a, b, start and select. quit ends the run
+   at the start of that frame
+ */
+class InputScript {
+public:
+  // false (with a message) if the file can't be read or parsed
+  bool load(const std::string &path);
+  // queues every key change on the joypad
+  void schedule(Joypad *joypad);
+  // true if the script ends the run at this frame
+  bool quit(unsigned long frame) { return frame >= quit_frame; }
+
+private:
+  struct Step {
+    unsigned long frame;
+    unsigned int clock;
+    unsigned char buttons, direction;
+  };
+  std::vector<Step> steps;
+  unsigned long quit_frame = ULONG_MAX;
+};
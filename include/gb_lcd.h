@@ -1,6 +1,10 @@
 #pragma once
+#include <chrono>
 #include <iostream>
 #include "gbcon.h"
+#include "gb_joypad.h"
+#include "gb_pacer.h"
+#include "gb_render.h"
 
 class LCD {
 public:
@@ -36,18 +40,82 @@ public:
 
   static const unsigned int LCD_Width  = 160;
   static const unsigned int LCD_Height = 144;
-  const double refresh_rate_hz = 59.7;
   static const unsigned int Num_Sprites = 40;
   static const unsigned int Num_Sprites_Per_Line = 10;
+  // PPU timing in clocks. "a scanline normally takes 456 clocks"-TCAGBD
+  static const unsigned int Cycles_Per_Line = 456;
+  static const unsigned int Lines_Per_Frame = 154;
+  static const unsigned int Cycles_Per_Frame = Cycles_Per_Line * Lines_Per_Frame;
+  static const unsigned int Oam_Search_Cycles = 80;
+  static const unsigned int Transfer_Cycles = 368;
+  static const unsigned int Hblank_Cycles = 8;
+  // DMG clock / clocks per frame, about 59.73 Hz
+  const double refresh_rate_hz = 4194304.0 / Cycles_Per_Frame;
+  // emulation speed relative to the DMG. 0 runs unthrottled
   double Speed_Multi = 1.0;
+  // speed while turbo is held. 0 runs unthrottled
+  double turbo_speed = 4.0;
+  bool turbo = false;
+  // frame pacing. disabled for benchmark runs
+  bool throttle = true;
+  FramePacer pacer;
+  // skip drawing frames that can't be shown. disabled for benchmark runs
+  bool frame_skip = true;
 
   /* LCD driver and helpers
    */
 
-  bool step(unsigned int cycles);
+  // advance the PPU. it only does work when the next mode boundary is reached
+  bool step(unsigned int cycles) {
+    cycles_this_frame += cycles;
+    if (cycles_this_frame < next_event) {
+      return false;
+    }
+    return run_events();
+  }
+  // clocks until the next mode boundary
+  unsigned int cycles_to_next_event(void) {
+    return next_event - cycles_this_frame;
+  }
   void init(GB_Sys *gb_sys);
 
+  // VRAM (0x8000-0x9FFF) was changed
+  void vram_written(unsigned short address, unsigned char value);
+  // OAM (0xFE00-0xFE9F) was changed, directly or by DMA
+  void oam_written(unsigned short address, unsigned char value);
+  // draw on a worker thread. set before init
+  bool threaded_render = false;
+  // gets every frame drawn, if set
+  Recorder *recorder = nullptr;
+  // gets every frame drawn at its VBLANK, if set
+  ShmExport *shm = nullptr;
+  // waits for the render thread and shows its last frame
+  void close(void);
+  // saves or restores registers and PPU timing (see gb_state.h)
+  void state(Snapshot &s);
+  // tells the renderer about VRAM/OAM bytes that differ from these, after
+  // memory was restored
+  void refresh_renderer(const unsigned char *old_vram,
+                        const unsigned char *old_oam);
+
+  /* run-ahead (see main). frames that aren't drawn aren't presented, and
+     frames that aren't host frames don't pace or poll input
+   */
+  bool draw_frames = true;
+  bool host_frame = true;
+
   unsigned int cycles_this_frame = 0;
+  unsigned long frames = 0;
+  // clocks since power on
+  unsigned long long cycle(void) {
+    return (unsigned long long)frames * Cycles_Per_Frame + cycles_this_frame;
+  }
+  // shades (0-3) of the last frame drawn, without --render-thread
+  const unsigned char *shades(void) const { return renderer.shades(); }
+  // frames identical to the previous one, so not uploaded or presented
+  unsigned long frames_unchanged = 0;
+  // frames emulated without drawing or presenting them
+  unsigned long frames_skipped = 0;
 
 private:
   /* GB system (pointers to other components)
@@ -55,6 +123,8 @@ private:
 
   Memory *mem;
   Interrupt *interrupt;
+  VideoBackend *video;
+  Joypad *joypad;
 
   /* Hardware registers
    */
@@ -115,45 +185,46 @@ private:
   /* LCD driver and helpers
    */
 
-  unsigned char gb_pixels[LCD_Width * LCD_Height];
-  inline void set_pixel(unsigned char x, unsigned char y, unsigned char gb_color_num);
-  inline unsigned char get_pixel(unsigned char x, unsigned char y);
-
-  void search_sprites(unsigned char line);
-  void draw_sprites(unsigned char line);
-  void draw_window(unsigned char line);
-  void draw_background(unsigned char line);
-  void render_scanline(unsigned char line);
+  Renderer renderer;
+  RenderThread render_thread;
+  void draw_line(unsigned char line);
+  void present_frame(bool changed);
+  void record_frame(void);
+  void publish_frame(unsigned long frame);
+
+  /* frame skipping. the PPU still runs its timing and interrupts on a
+     skipped frame, but no lines are drawn and nothing is presented. frames
+     are skipped when emulating faster than the display can show them, or
+     when running behind at normal speed (up to Max_Frame_Skip in a row)
+   */
+  static const unsigned int Max_Frame_Skip = 4;
+  bool skip_frame = false;
+  // the frame the render thread is drawing was skipped (or there's none)
+  bool render_skipped = true;
+  unsigned int skip_run = 0;
+  std::chrono::steady_clock::time_point last_shown;
+  bool should_skip(double speed, bool paced);
+
+  // key changes from the backend, and when it was last asked for them
+  std::vector<Input_Change> input_changes;
+  std::chrono::steady_clock::time_point last_input_poll;
+
+  /* unchanged frame detection. ppu_generation counts writes that change
+     anything the PPU draws (VRAM, OAM, LCDC, scroll, window and palette
+     registers). the renderer skips lines drawn at the same generation, and
+     frames that come out unchanged aren't presented
+   */
+  unsigned long ppu_generation = 1;
 
-  /* misc
+  /* PPU events. next_event is the frame cycle of the next mode boundary
    */
 
-  Screen_Mode prev_mode;
-  unsigned int ms_last_vblank = 0;
-
-  struct Sprite_Attr_Masks {
-    const unsigned char Priority = 0x80;  // bit7
-    const unsigned char Y_Flip   = 0x40;
-    const unsigned char X_Flip   = 0x20;
-    const unsigned char Palette  = 0x10;
-    const unsigned char Unused   = 0x0f;  //bit0 (unused for DMG)
-  } Sprite_Attr_Masks;
-
-
-  // emulator sprite metadata 
-  struct Sprite_Emu {
-    bool in_line_range;
-    bool in_screen_x;
-    unsigned short oram_addr;
-  }; 
-  struct Sprite {
-    int y_pos;
-    int x_pos;
-    unsigned char tile_num;
-    unsigned char attr;
-    Sprite_Emu meta;
-  } sprites[Num_Sprites]; // 40 is the max number of sprites (0xfe00-0xfeff)
-
-  Sprite* display_sprites[Num_Sprites_Per_Line];
-  int sprites_this_line = 0;
+  unsigned int next_event = 0;
+  bool run_events(void);
+  void start_line(unsigned char line);
+  // internal STAT interrupt line. see update_stat_line
+  bool stat_line = false;
+  void update_stat_line(void);
+  bool end_frame(void);
+
 };
@@ -3,11 +3,16 @@
 #include <iomanip>
 #include <fstream>
 
+class Snapshot;
+
 class MBC {
     public:
         MBC(unsigned char *p_ram, unsigned char *p_rom);
         unsigned char read_byte(unsigned short address);
         virtual void write_byte(unsigned short address, unsigned char value) = 0;
+        unsigned short get_rom_bank(void) { return curr_rom_bank; }
+        // saves or restores the bank registers (see gb_state.h)
+        void state(Snapshot &s);
     protected:
         unsigned char *rom;
         unsigned char *ram;
@@ -3,6 +3,8 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <bitset>
+#include <vector>
 
 #define BOOT_ROM_SIZE 0x100
 
@@ -14,6 +16,8 @@ class Memory {
 public:
   unsigned short last_mem_addr_dbg;
   unsigned char read_byte(unsigned short address);
+  // read without side effects on the debugger (PPU fetches, debugger views)
+  unsigned char peek_byte(unsigned short address);
   unsigned short read_short(unsigned short address);
   unsigned short read_short_stack(unsigned short sp);
 
@@ -26,15 +30,24 @@ public:
   /* debug and helpers */
   void print_memory_range(unsigned short start_addr, unsigned short blocks);
   void print_to_file(string log_dir);
+  void write_serial_log_file(string filepath);
 
   unsigned char boot_rom[BOOT_ROM_SIZE];
 
-  unsigned char serial_tx_data;
-  unsigned char serial_rx_data;
-  bool serial_tx_initd = false;
+  // bytes sent out the serial port (blargg's test roms print here)
+  std::vector<char> serial_data;
   bool remapped_cart = false;
 
+  /* debugger watchpoint traps. one bit per address, maintained by Debug.
+     traps_enabled is only set while at least one watchpoint exists so the
+     read/write paths pay a single predictable branch otherwise */
+  std::bitset<0x10000> read_traps;
+  std::bitset<0x10000> write_traps;
+  bool traps_enabled = false;
+
   void init(GB_Sys *gb_sys);
+  // saves or restores RAM, I/O registers and serial output (see gb_state.h)
+  void state(Snapshot &s);
 
 //private:
   /* GB system (pointers to other components)
@@ -45,6 +58,7 @@ public:
   LCD       *lcd;
   Interrupt *interrupt;
   Timer     *timer;
+  Debug     *dbg;
 
   /* Gameboy Memory Map
   Start	End	Description	Notes
@@ -0,0 +1,42 @@
+#pragma once
+#include <chrono>
+#include <iostream>
+
+/* Frame pacing against the host's monotonic clock. Each frame has an
+   absolute deadline one period after the last one, so sleep overshoot on
+   one frame is made up on the next instead of accumulating. Most of the wait
+   is a clock_nanosleep to just short of the deadline, then a short spin for
+   the rest.
+ */
+class FramePacer {
+public:
+  // blocks until the next frame is due at hz frames per second
+  void wait(double hz);
+  // forget the schedule. the next wait starts a new one
+  void reset(void) { rate_hz = 0; }
+  // the last frame reached wait after its deadline had already passed
+  bool behind(void) const { return late; }
+  // frame interval jitter measured so far
+  void print_stats(std::ostream &os);
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  // sleep this far short of a deadline and spin the rest
+  const std::chrono::microseconds Spin_Margin{500};
+  // further behind than this (debugger, slow host) starts a new schedule
+  const int Max_Frames_Behind = 4;
+
+  double rate_hz = 0;
+  clock::duration period{};
+  clock::time_point deadline;
+  bool late = false;
+
+  // frame interval stats, in seconds
+  clock::time_point last_frame;
+  unsigned long intervals = 0;
+  double interval_sum = 0;
+  double interval_sum_sq = 0;
+  double max_error = 0;
+  unsigned long resyncs = 0;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+/* Lock-free handoff between the emulation thread and the presentation
+   thread (see sdl_init). Neither side ever blocks on the other.
+ */
+
+/* Triple buffer of whole frames. The producer always has a back buffer to
+   draw into and publishing swaps it with the middle one. The consumer takes
+   the middle buffer only if something new was published since it last
+   looked, so it always shows the newest finished frame and the ones in
+   between are dropped.
+ */
+template <typename T, size_t N> class TripleBuffer {
+public:
+  // producer side
+  T *back_buffer(void) { return buffers[back]; }
+  void publish(void) {
+    back = middle.exchange(back | Fresh, std::memory_order_acq_rel) &
+           Index_Mask;
+  }
+
+  // consumer side
+  bool fresh(void) const {
+    return middle.load(std::memory_order_acquire) & Fresh;
+  }
+  // newest published frame, or nullptr if there's nothing new
+  const T *consume(void) {
+    if (!fresh()) {
+      return nullptr;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & Index_Mask;
+    return buffers[front];
+  }
+
+private:
+  static const unsigned int Index_Mask = 0x3;
+  // set in middle when it holds a frame the consumer hasn't taken
+  static const unsigned int Fresh = 0x4;
+
+  T buffers[3][N];
+  unsigned int back = 0;
+  unsigned int front = 1;
+  std::atomic<unsigned int> middle{2};
+};
+
+/* Bounded single-producer single-consumer queue. N must be a power of 2.
+   push fails when full, pop when empty. Large items can be filled and read
+   in place instead: claim/commit on the producer side, peek/release on the
+   consumer side
+ */
+template <typename T, size_t N> class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of 2");
+
+public:
+  bool push(const T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // free slot to fill, or nullptr if full. commit queues it
+  T *claim(void) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N) {
+      return nullptr;
+    }
+    return &items[h & (N - 1)];
+  }
+  void commit(void) {
+    head.store(head.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  // oldest item, or nullptr if empty. it stays queued until release
+  const T *peek(void) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &items[t & (N - 1)];
+  }
+  void release(void) {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+private:
+  T items[N];
+  // kept on separate cache lines so the two threads don't share one
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+};
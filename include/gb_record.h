@@ -0,0 +1,77 @@
+#pragma once
+#include "gb_present.h"
+#include "gb_render.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* Gameplay recording (--record). The LCD hands over every frame it draws as
+   shades (0-3) and writer threads turn them into files:
+
+     out.y4m         YUV4MPEG2 video at the DMG frame rate
+     |command        the same stream piped into command's stdin, e.g.
+                     "|ffmpeg -i - out.mp4"
+     shots/run.png   indexed PNGs, shots/run000000.png and on
+
+   Frames go to the writers through bounded lock-free queues and push never
+   waits: when the writers are behind the frame is dropped and counted. A
+   video stream repeats the previous frame in its place so it keeps time.
+ */
+class Recorder {
+public:
+  ~Recorder();
+  // false (with a message) if target can't be opened or isn't a known format
+  bool open(const std::string &target);
+  // queues the next frame. LCD_Width * LCD_Height shades
+  void push(const unsigned char *shades);
+  // writes out everything queued, stops the writers and prints the totals
+  void close(void);
+
+  unsigned long frames_recorded = 0;
+  unsigned long frames_dropped = 0;
+
+private:
+  static const unsigned int LCD_Width = Renderer::LCD_Width;
+  static const unsigned int LCD_Height = Renderer::LCD_Height;
+  // PNGs are independent files, so they're written by up to this many threads
+  static const unsigned int Max_Png_Writers = 4;
+  // frames each writer can fall behind by
+  static const size_t Queue_Frames = 16;
+
+  struct Frame {
+    unsigned long number;
+    unsigned char shades[LCD_Width * LCD_Height];
+  };
+  struct Writer {
+    SpscQueue<Frame, Queue_Frames> queue;
+    std::thread thread;
+    // only for the writer's wait when its queue is empty (see writer_loop)
+    std::mutex lock;
+    std::condition_variable cv;
+  };
+  Writer writers[Max_Png_Writers];
+  unsigned int num_writers = 0;
+  // writer the next frame is offered to first
+  unsigned int next_writer = 0;
+  std::atomic<bool> done{false};
+  // set by a writer when output fails. nothing more is queued after that
+  std::atomic<bool> failed{false};
+
+  enum Format { Y4M, PNG } format = Y4M;
+  std::string target;
+  FILE *out = nullptr;
+  bool piped = false;
+
+  void writer_loop(Writer *w);
+  void fail(const char *what);
+
+  // y4m output. only ever one writer
+  unsigned char yuv[LCD_Width * LCD_Height * 3 / 2];
+  unsigned long next_number = 0;
+  bool write_y4m(const Frame &f);
+  // png output. path is target with the frame number before .png
+  bool write_png(const Frame &f);
+};
@@ -0,0 +1,195 @@
+#pragma once
+#include <bitset>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class VideoBackend;
+
+/* Scanline renderer. Works from its own copy of VRAM and OAM, kept up to
+   date by write_vram/write_oam, and a snapshot of the PPU registers taken
+   when a line's mode 3 starts. Nothing it reads belongs to the emulation
+   thread, so it can be driven directly by the LCD or from a worker thread
+   (RenderThread) and produce the same frames either way.
+ */
+class Renderer {
+public:
+  static const unsigned int LCD_Width  = 160;
+  static const unsigned int LCD_Height = 144;
+  static const unsigned int Num_Sprites = 40;
+  static const unsigned int Num_Sprites_Per_Line = 10;
+
+  // PPU registers that affect drawing, as of mode 3 of a line
+  struct Regs {
+    unsigned char lcdc, scy, scx, wy, wx, bgp, obp0, obp1;
+  };
+
+  // copies VRAM/OAM and rebuilds everything derived from them
+  void init(const unsigned char *vram_src, const unsigned char *oam_src);
+  // offset from 0x8000
+  void write_vram(unsigned short offset, unsigned char value);
+  // offset from 0xFE00
+  void write_oam(unsigned char offset, unsigned char value);
+  // draws a line, unless nothing has changed since it was last drawn. see
+  // LCD::ppu_generation
+  void draw_line(unsigned char line, const Regs &line_regs,
+                 unsigned long generation);
+  // true if the frame differs from the previous one. its ARGB pixels are
+  // then in output's locked frame (or argb)
+  bool end_frame(void);
+
+  // locked on the first changed line of a frame to draw ARGB into. if
+  // unset, frames go into argb
+  VideoBackend *output = nullptr;
+  unsigned int argb[LCD_Width * LCD_Height];
+  // shades (0-3) of the last frame drawn, changed or not
+  const unsigned char *shades(void) const { return gb_pixels; }
+
+private:
+  unsigned char vram[0x2000];
+  unsigned char oam[0xA0];
+
+  // registers for the line being drawn, and what's derived from them
+  Regs regs = {};
+  unsigned char bgp_dots[4] = {};
+  unsigned char obp_dots[2][4] = {};
+  void set_regs(const Regs &line_regs);
+
+  // bg/window color numbers for the line being drawn, before BGP is applied
+  unsigned char line_colors[LCD_Width];
+  // shades for the line being drawn
+  unsigned char line_shades[LCD_Width];
+  // shades of the last frame drawn
+  unsigned char gb_pixels[LCD_Width * LCD_Height];
+
+  /* unchanged frame detection. a line isn't redrawn if the PPU generation
+     is the same as when it was last drawn, and a redrawn line that comes
+     out the same as in gb_pixels doesn't count as a change. the frame
+     (pitch in pixels) is only locked on the first changed line
+   */
+  unsigned long line_generation[LCD_Height] = {};
+  unsigned int *frame_pixels = nullptr;
+  int frame_pitch = 0;
+  inline void expand_line(unsigned char line);
+
+  /* decoded tile cache. color numbers for every pixel of the 384 tiles in
+     VRAM so the renderers don't decode 2bpp data on every line. tiles
+     0-255 are at 0x8000, 256-383 at 0x9000 (0x8800 signed addressing)
+   */
+  static const unsigned int Num_Tiles = 384;
+  unsigned char tile_cache[Num_Tiles][8][8];
+  // tile cache index of a bg/window tile number under the current tileset
+  inline unsigned int bg_tile_index(unsigned char tilenum);
+
+  /* the two 32x32 tile maps (0x9800 and 0x9C00) drawn out as 256x256 color
+     number bitmaps, so a bg/window line is a copy out of a bitmap row.
+     updated lazily before a line is rendered: map entries that were
+     written and entries that use a changed tile are redrawn, and
+     everything is redrawn when the tileset select flips
+   */
+  unsigned char map_bitmaps[2][256][256];
+  std::bitset<1024> map_entry_dirty[2];
+  std::bitset<Num_Tiles> tile_dirty;
+  bool map_bitmaps_dirty = true;
+  void update_map_bitmaps(void);
+
+  template <bool Tall_Sprites> void draw_sprites(unsigned char line);
+  void draw_window(unsigned char line);
+  void draw_background(unsigned char line);
+
+  /* line renderers specialised on the LCDC bits that decide what gets drawn,
+     so rendering a line doesn't branch on them. set_regs picks the one for
+     the current LCDC, and the tile map bitmaps for bg and window
+   */
+  typedef void (Renderer::*Line_Renderer)(unsigned char line);
+  template <bool Bg, bool Window, bool Sprites, bool Tall_Sprites>
+  void render_scanline(unsigned char line);
+  // indexed by LCDC bits 0-2, then bit 5 as bit 3
+  static const Line_Renderer Line_Renderers[16];
+  Line_Renderer render_line = Line_Renderers[0];
+  const unsigned char (*bg_map)[256] = map_bitmaps[0];
+  const unsigned char (*window_map)[256] = map_bitmaps[0];
+
+  struct Sprite_Attr_Masks {
+    const unsigned char Priority = 0x80;  // bit7
+    const unsigned char Y_Flip   = 0x40;
+    const unsigned char X_Flip   = 0x20;
+    const unsigned char Palette  = 0x10;
+    const unsigned char Unused   = 0x0f;  //bit0 (unused for DMG)
+  } Sprite_Attr_Masks;
+
+  // in OAM order
+  struct Sprite {
+    int y_pos;
+    int x_pos;
+    unsigned char tile_num;
+    unsigned char attr;
+  } sprites[Num_Sprites]; // 40 is the max number of sprites (0xfe00-0xfe9f)
+
+  /* sprite table. OAM parsed into sprites[] and bucketed by line: for each
+     line the sprites the PPU picks (the first 10 in OAM order that cover
+     it), stored in draw order so the highest priority one is drawn last.
+     rebuilt before the next rendered line after OAM or the sprite size
+     changes
+   */
+  bool sprite_table_dirty = true;
+  // indexes into sprites[]
+  unsigned char line_sprites[LCD_Height][Num_Sprites_Per_Line];
+  unsigned char line_sprite_count[LCD_Height];
+  void rebuild_sprite_table(void);
+};
+
+/* Runs a Renderer on a worker thread. The emulation thread records VRAM/OAM
+   writes and line register snapshots in order. At the end of each frame the
+   whole log goes to the worker, which draws that frame while the next one
+   is emulated. Frames come out one frame late.
+ */
+class RenderThread {
+public:
+  ~RenderThread();
+  void start(Renderer *r);
+  void close(void);
+
+  void write_vram(unsigned short offset, unsigned char value) {
+    log->push_back(Render_Cmd{Render_Cmd::VRAM, 0, offset, value, {}, 0});
+  }
+  void write_oam(unsigned char offset, unsigned char value) {
+    log->push_back(Render_Cmd{Render_Cmd::OAM, 0, offset, value, {}, 0});
+  }
+  void draw_line(unsigned char line, const Renderer::Regs &regs,
+                 unsigned long generation) {
+    log->push_back(Render_Cmd{Render_Cmd::LINE, line, 0, 0, regs, generation});
+  }
+
+  // waits for the worker to finish the frame it was last given. returns
+  // Renderer::end_frame for it. its pixels stay in Renderer::argb until
+  // submit_frame
+  bool finish_frame(void);
+  // hands this frame's log to the worker
+  void submit_frame(void);
+
+private:
+  struct Render_Cmd {
+    enum Type : unsigned char { VRAM, OAM, LINE, FRAME } type;
+    unsigned char line;
+    unsigned short offset;
+    unsigned char value;
+    Renderer::Regs regs;
+    unsigned long generation;
+  };
+
+  void worker_loop(void);
+
+  Renderer *renderer = nullptr;
+  std::vector<Render_Cmd> logs[2];
+  std::vector<Render_Cmd> *log = &logs[0];
+
+  // hand-off to the worker thread
+  std::thread worker;
+  std::mutex lock;
+  std::condition_variable cv;
+  const std::vector<Render_Cmd> *pending = nullptr;
+  bool frame_changed = false;
+  bool done = false;
+};
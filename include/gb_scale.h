@@ -0,0 +1,65 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Upscaling on the CPU, between the LCD's ARGB frame and the window texture,
+   for hosts where SDL scales in software (slowly, and blurry with some
+   drivers). Integer factors only.
+
+   NEAREST repeats pixels. SCALE2X and SCALE3X (AdvMAME) round off diagonal
+   edges, and at larger multiples of 2 or 3 their output is repeated (scale2x
+   at 4x is Scale2x then 2x nearest). The frame is cut into bands of rows
+   scaled in parallel by a few helper threads.
+ */
+class Scaler {
+public:
+  static const unsigned int LCD_Width = 160;
+  static const unsigned int LCD_Height = 144;
+  static const unsigned int Max_Factor = 8;
+  // threads a frame is split over, the caller included
+  static const unsigned int Max_Bands = 4;
+
+  // AUTO scales with NEAREST if SDL's renderer is a software one and leaves
+  // it to SDL otherwise. SDL always leaves it to SDL
+  enum Filter { AUTO, SDL, NEAREST, SCALE2X, SCALE3X };
+  // false if name isn't a filter
+  static bool parse_filter(const std::string &name, Filter *filter);
+  // factors filter can scale by are multiples of this
+  static unsigned int filter_factor(Filter filter);
+
+  ~Scaler();
+  void init(Filter filter, unsigned int factor);
+  void close(void);
+  // scales a frame into out, which is LCD_Width * factor wide (pitch in
+  // pixels)
+  void scale(const unsigned int *in, unsigned int *out, int pitch);
+
+private:
+  Filter filter = NEAREST;
+  unsigned int factor = 1;
+  // output rows per filtered row, repeated by nearest
+  unsigned int repeat = 1;
+  void scale_band(unsigned int band);
+
+  /* helper threads. band 0 is scaled by the caller, band i by helper i-1.
+     a frame is handed out by bumping job, and the caller waits for busy to
+     drop to 0
+   */
+  unsigned int num_bands = 1;
+  std::vector<std::thread> helpers;
+  std::mutex lock;
+  std::condition_variable start_cv;
+  std::condition_variable done_cv;
+  unsigned long job = 0;
+  unsigned int busy = 0;
+  bool done = false;
+  void helper_loop(unsigned int band);
+
+  // the frame being scaled
+  const unsigned int *in = nullptr;
+  unsigned int *out = nullptr;
+  int pitch = 0;
+};
@@ -1,8 +1,11 @@
 #pragma once
 #include "SDL.h"
+#include "gb_joypad.h"
+#include "gb_scale.h"
 #include <sys/time.h>
 #include <iostream>
 #include <mutex>
+#include <vector>
 
 const unsigned int LCD_Width  = 160;
 const unsigned int LCD_Height = 144;
@@ -16,6 +19,9 @@ struct display {
     SDL_Texture *frameBuffer;
     SDL_Surface *surface;
     unsigned int frames;
+    // frameBuffer is locked for the PPU to draw into
+    bool locked;
+    // stand-in frame when there's no texture to lock
     Uint32 pixels[LCD_Width * LCD_Height];
 };
 
@@ -32,6 +38,10 @@ struct sdl_joypad {
 
 struct Sdl_params {
     int scale;
+    // who scales frames up to the window (see gb_scale.h)
+    Scaler::Filter filter;
+    // present frames and poll events on a separate thread
+    bool present_thread;
 //    int window_pos_x;
 //    int window_pos_y;
 };
@@ -42,12 +52,19 @@ struct Sdl_emu_keys {
     bool pause;
     bool save_ram;
     bool load_ram;
+    // held
+    bool turbo;
 };
 typedef struct Sdl_emu_keys Sdl_emu_keys;
 
 void sdl_init(Sdl_params p);
 void sdl_uninit();
 void sdl_set_frame(void);
-int sdl_update(void);
+// polls events. key changes are appended to input. returns 1 on quit
+int sdl_update(std::vector<Input_Change> &input);
 
-void set_sdl_pixels(const unsigned char *gb_pixels);
+// locks the frame texture so the PPU can write ARGB lines straight into it.
+// pitch is returned in pixels. sdl_set_frame unlocks and presents it
+Uint32 *sdl_lock_frame(int *pitch);
+// uploads a whole ARGB frame and presents it
+void sdl_present_pixels(const Uint32 *pixels);
@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* Frame and input export through POSIX shared memory (--shm NAME), for
+   tools that want to watch or drive the emulator without scraping the
+   window. /dev/shm/NAME holds a Shm_Header followed by Shm_Slots frames.
+
+   Frames. Every frame (frame skipping is off) is written as ARGB into the
+   next slot at VBLANK (a frame later with --render-thread), under a
+   seqlock: seq is odd while the slot is being written and goes up by 2
+   each time. A reader takes published, reads slot (published - 1) %
+   Shm_Slots and keeps the copy only if seq was even and unchanged across
+   it. To block until the next frame, add yourself to waiters (a seq_cst
+   read-modify-write) and FUTEX_WAIT on published. The writer stores
+   published and then reads waiters, both seq_cst, so one of the two sides
+   always sees the other and a wake can't be missed.
+
+   Input. A client sets input to Shm_Input_Active | keys, with buttons (a,
+   b, select, start) in bits 0-3 and directions (right, left, up, down) in
+   bits 4-7 as in gb_joypad.h. Changes are applied at the emulated clock
+   they're seen at, like keyboard input, and the last change from either
+   wins. Clearing Shm_Input_Active releases the keys.
+
+   See tools/gb_shm_tool.cpp (GBshm) for a reader.
+ */
+
+const char Shm_Magic[8] = {'G', 'B', 'C', 'O', 'N', 'S', 'H', 'M'};
+const uint32_t Shm_Version = 1;
+const uint32_t Shm_Slots = 4;
+const uint32_t Shm_Width = 160;
+const uint32_t Shm_Height = 144;
+const uint32_t Shm_Input_Active = 0x100;
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory needs address-free 32 bit atomics");
+
+struct Shm_Frame {
+  std::atomic<uint32_t> seq;
+  uint32_t reserved;
+  // emulated frame number and clocks since power on at its VBLANK
+  uint64_t frame;
+  uint64_t cycle;
+  // CLOCK_MONOTONIC nanoseconds when the slot was written
+  uint64_t host_ns;
+  uint32_t pixels[Shm_Width * Shm_Height];
+};
+
+struct Shm_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t width, height;
+  uint32_t slots;
+  // from the start of the segment, and between slots
+  uint32_t frame_offset;
+  uint32_t frame_size;
+  // frames written so far (wraps). futex word
+  std::atomic<uint32_t> published;
+  // readers in FUTEX_WAIT on published. the writer only wakes if non zero
+  std::atomic<uint32_t> waiters;
+  // keys from a client (see above)
+  std::atomic<uint32_t> input;
+  uint32_t pid;
+};
+
+class Joypad;
+
+// the emulator's side: creates the segment, writes frames, reads input
+class ShmExport {
+public:
+  ~ShmExport();
+  // false (with a message) if the segment can't be created
+  bool open(const std::string &name);
+  void close(void);
+  bool active(void) const { return header != nullptr; }
+
+  // writes a frame of shades (0-3) to the next slot and wakes waiters
+  void publish(const unsigned char *shades, unsigned long frame,
+               unsigned long long cycle);
+  // queues a change of the input slot on the joypad at cycle
+  void poll_input(Joypad *joypad, unsigned long long cycle) {
+    uint32_t keys = header->input.load(std::memory_order_relaxed);
+    if (keys != last_input) {
+      apply_input(joypad, cycle, keys);
+    }
+  }
+
+private:
+  std::string name;
+  Shm_Header *header = nullptr;
+  size_t size = 0;
+  uint32_t last_input = 0;
+  void apply_input(Joypad *joypad, unsigned long long cycle, uint32_t keys);
+};
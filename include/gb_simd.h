@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+
+/* Pixel kernels for the PPU and display path. Each has a scalar version and,
+   on x86, SSE2 and AVX2 versions. The best one the host supports is picked
+   once at startup by cpuid; everything else calls through gb_simd::kernels.
+ */
+namespace gb_simd {
+  enum Isa { SCALAR, SSE2, AVX2 };
+
+  struct Kernels {
+    const char *name;
+    // 2bpp tile data (2 bytes per row, VRAM layout) -> 8 color numbers per row
+    void (*decode_tile_rows)(const unsigned char *data, unsigned char *out,
+                             size_t rows);
+    // color numbers 0-3 -> shades through a BGP/OBP0/OBP1 register value
+    void (*map_palette)(const unsigned char *in, unsigned char *out, size_t n,
+                        unsigned char palette);
+    // shades 0-3 -> 32-bit ARGB
+    void (*expand_argb)(const unsigned char *in, unsigned int *out, size_t n,
+                        const unsigned int colors[4]);
+
+    /* upscaling (see gb_scale.h)
+     */
+
+    // each ARGB pixel repeated factor (1-8) times
+    void (*scale_row)(const unsigned int *in, unsigned int *out, size_t n,
+                      unsigned int factor);
+    // Scale2x/Scale3x (AdvMAME) of row into 2 or 3 output rows of 2n or 3n
+    // pixels. above, row and below must be readable at [-1] and [n]
+    void (*scale2x_row)(const unsigned int *above, const unsigned int *row,
+                        const unsigned int *below, unsigned int *const out[2],
+                        size_t n);
+    void (*scale3x_row)(const unsigned int *above, const unsigned int *row,
+                        const unsigned int *below, unsigned int *const out[3],
+                        size_t n);
+  };
+
+  extern const Kernels *kernels;
+
+  // a specific variant, or nullptr if the host can't run it
+  const Kernels *get_kernels(Isa isa);
+}
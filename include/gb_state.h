@@ -0,0 +1,104 @@
+#pragma once
+#include "gbcon.h"
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/* Snapshot of emulator state in a flat byte buffer. Each component lists
+   its fields once in a state(Snapshot &) function, and the same code saves
+   or restores them depending on the mode the snapshot is in. Saving reuses
+   the buffer, so a snapshot per frame costs a few memcpys. Loading never
+   reads past the end of the buffer: a read that would marks the load as
+   failed and leaves the value alone, so a state from outside can be
+   checked with loaded_all().
+ */
+class Snapshot {
+public:
+  void begin_save(void) {
+    data.clear();
+    loading = false;
+  }
+  void begin_load(void) {
+    pos = 0;
+    loading = true;
+    failed = false;
+  }
+  bool is_loading(void) const { return loading; }
+
+  template <typename T> void io(T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only plain values can be copied into a snapshot");
+    io_bytes(&value, sizeof(T));
+  }
+  void io_bytes(void *p, size_t len) {
+    if (loading) {
+      if (!expect(len, 1)) {
+        return;
+      }
+      memcpy(p, &data[pos], len);
+      pos += len;
+    } else {
+      const unsigned char *bytes = (const unsigned char *)p;
+      data.insert(data.end(), bytes, bytes + len);
+    }
+  }
+
+  // while loading, whether count items of size bytes are left. if not, the
+  // load fails. for lengths read from the state before they're allocated
+  bool expect(size_t count, size_t size) {
+    if (failed || count > (data.size() - pos) / size) {
+      failed = true;
+    }
+    return !failed;
+  }
+  // while loading, gives up on a state found to be wrong
+  void fail(void) { failed = true; }
+  // the load read every byte and nothing past them
+  bool loaded_all(void) const { return !failed && pos == data.size(); }
+
+  size_t size(void) const { return data.size(); }
+  const unsigned char *bytes(void) const { return data.data(); }
+  // replaces the contents, to be loaded
+  void assign(const unsigned char *p, size_t len) { data.assign(p, p + len); }
+
+private:
+  std::vector<unsigned char> data;
+  size_t pos = 0;
+  bool loading = false;
+  bool failed = false;
+};
+
+/* Whole-machine save and restore: CPU, memory, cartridge RAM and MBC, LCD,
+   timer, interrupts and the joypad queue. Host-side state (the renderer's
+   caches, pacing, stats) isn't part of it. After a restore the renderer is
+   given whatever VRAM/OAM bytes the restore changed.
+
+   A state starts with State_Magic, State_Version and the ROM's checksum,
+   and is only loaded by a build with the same version running the same
+   ROM. Bump State_Version when any component's state() changes.
+ */
+const char State_Magic[8] = {'G', 'B', 'C', 'O', 'N', 'S', 'T', 'A'};
+const unsigned int State_Version = 1;
+
+class SaveState {
+public:
+  void init(GB_Sys *gb_sys);
+  void save(void);
+  void load(void);
+  // the last save
+  const Snapshot &saved(void) const { return snapshot; }
+  // loads a state from outside (see gb_control.h). if it's another ROM's or
+  // version's, is cut short, runs long or has lengths that don't fit, the
+  // machine is left as it was and false is returned
+  bool load_bytes(const unsigned char *p, size_t len);
+
+private:
+  Snapshot snapshot;
+  // the machine before load_bytes, to go back to if it fails
+  Snapshot undo;
+  GB_Sys sys;
+  // VRAM and OAM just before a load
+  unsigned char old_vram[0x2000];
+  unsigned char old_oam[0xA0];
+  void state(Snapshot &s);
+};
@@ -37,6 +37,8 @@ public:
   void step(void);
 
   void init(GB_Sys *gb_sys);
+  // saves or restores the timer registers and counters (see gb_state.h)
+  void state(Snapshot &s);
 
 private:
   /* GB system (pointers to other components)
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Binary CPU state trace. One fixed-size record per executed instruction
+   holding the same fields as the gameboy-doctor text log, so full runs can be
+   diffed against reference emulators. Records are buffered in large blocks
+   and written by a background thread so the CPU loop never waits on disk
+   unless it gets a whole buffer ahead of it.
+
+   Files start with Trace_Magic followed by packed Trace_Entry records. Use
+   GBtrace (tools/) to convert them to text or diff them.
+*/
+
+struct Trace_Entry {
+  unsigned char a, f, b, c, d, e, h, l;
+  unsigned short sp, pc;
+  unsigned char pcmem[4]; // bytes at pc..pc+3
+};
+static_assert(sizeof(Trace_Entry) == 16, "trace records must stay packed");
+
+const char Trace_Magic[8] = {'G', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// formats e as a gameboy-doctor log line (no newline). returns length
+int format_doctor_line(char *buf, size_t len, const Trace_Entry &e);
+// parses a gameboy-doctor log line. returns false if it doesn't match
+bool parse_doctor_line(const char *line, Trace_Entry &e);
+
+class TraceWriter {
+public:
+  ~TraceWriter();
+  bool open(const std::string &path);
+  void close(void);
+
+  void record(const Trace_Entry &e) {
+    buf[count++] = e;
+    if (count == Buffer_Entries) {
+      flush();
+    }
+  }
+
+  unsigned long long entries_written = 0;
+
+private:
+  // 16MB per buffer
+  static const size_t Buffer_Entries = 1 << 20;
+
+  void flush(void);
+  void writer_loop(void);
+  // reports a failed write once. nothing more is written after it
+  void fail(void);
+
+  std::string path;
+  FILE *out = nullptr;
+  std::atomic<bool> failed{false};
+  std::vector<Trace_Entry> buffers[2];
+  Trace_Entry *buf = nullptr;
+  size_t count = 0;
+  int active = 0;
+
+  // hand-off to the writer thread
+  std::thread writer;
+  std::mutex lock;
+  std::condition_variable cv;
+  const Trace_Entry *pending = nullptr;
+  size_t pending_count = 0;
+  bool done = false;
+};
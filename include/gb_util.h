@@ -3,6 +3,8 @@
 
 namespace gb_util {
   std::vector<std::string> split(const std::string& s, char delim);
+  std::string join(const std::vector<std::string>& tokens, size_t first,
+                   size_t last, char delim);
   std::string get_console_line(void);
 
   unsigned short stous(std::string const &str, size_t *idx = 0, int base = 10);
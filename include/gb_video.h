@@ -0,0 +1,63 @@
+#pragma once
+#include "gb_joypad.h"
+#include "gb_sdl.h"
+#include <vector>
+
+/* Where finished frames go and where input comes from. The LCD only talks
+   to the emulator's surroundings through this.
+ */
+class VideoBackend {
+public:
+  virtual ~VideoBackend() {}
+  // frame to draw ARGB lines into (pitch in pixels). present_frame shows it
+  virtual unsigned int *lock_frame(int *pitch) = 0;
+  virtual void present_frame(void) = 0;
+  // shows a whole ARGB frame
+  virtual void present_pixels(const unsigned int *pixels) = 0;
+  // once per frame. appends key changes since the last call to input.
+  // returns true to quit
+  virtual bool update(std::vector<Input_Change> &input) = 0;
+  virtual void close(void) = 0;
+};
+
+// window and keyboard through SDL (gb_sdl)
+class SdlBackend : public VideoBackend {
+public:
+  explicit SdlBackend(Sdl_params p) { sdl_init(p); }
+  unsigned int *lock_frame(int *pitch) override {
+    return sdl_lock_frame(pitch);
+  }
+  void present_frame(void) override { sdl_set_frame(); }
+  void present_pixels(const unsigned int *pixels) override {
+    sdl_present_pixels(pixels);
+  }
+  bool update(std::vector<Input_Change> &input) override {
+    return sdl_update(input);
+  }
+  void close(void) override { sdl_uninit(); }
+};
+
+/* No window, no pacing and no event polling. Frames are drawn into memory
+   and dropped. Input comes from an InputScript, queued on the joypad up
+   front
+ */
+class NullBackend : public VideoBackend {
+public:
+  unsigned int *lock_frame(int *pitch) override {
+    *pitch = LCD_Width;
+    return pixels;
+  }
+  void present_frame(void) override {}
+  void present_pixels(const unsigned int *) override {}
+  bool update(std::vector<Input_Change> &) override {
+    return script.quit(++frames);
+  }
+  void close(void) override {}
+
+  InputScript script;
+
+private:
+  unsigned int pixels[LCD_Width * LCD_Height];
+  // the frame about to be emulated
+  unsigned long frames = 0;
+};
@@ -7,6 +7,11 @@ class LCD;
 class Interrupt;
 class Timer;
 class Debug;
+class VideoBackend;
+class Joypad;
+class Snapshot;
+class Recorder;
+class ShmExport;
 
 struct GB_Sys {
   CPU       *cpu;
@@ -16,4 +21,6 @@ struct GB_Sys {
   Interrupt *interrupt;
   Timer     *timer;
   Debug     *dbg;
+  VideoBackend *video;
+  Joypad    *joypad;
 };
@@ -1,3 +1,5 @@
+require 'socket'
+
 describe 'gameboy' do
   def run_emu_dbg(argv,commands)
     raw_output = nil
@@ -48,6 +50,87 @@ describe 'gameboy' do
     end
   end
 
+  describe 'debugger' do
+    it 'stops on a watched memory write' do
+      argv = [
+        "bin/GBcon",
+        "--bios", "tests/resources/gb_bios.bin",
+        "--rom", "tests/resources/blarggs/cpu_instrs.gb",
+        "--dbg",
+      ]
+      debugger_commands = [
+        "watch 0xff01 w",
+        "continue",
+        "quit",
+      ]
+      result = run_emu_dbg(argv,debugger_commands)
+      expect(result.any? { |line| line.include?("watchpoint 0 hit: write 0xff01") }).to be true
+    end
+
+    it 'logs tracepoints and honours breakpoint conditions' do
+      argv = [
+        "bin/GBcon",
+        "--bios", "tests/resources/gb_bios.bin",
+        "--rom", "tests/resources/blarggs/cpu_instrs.gb",
+        "--dbg",
+      ]
+      debugger_commands = [
+        "trace 0x06f1 [0xff44]",
+        "break 0x06f1 if pc==0x06f1 && sp!=0",
+        "continue",
+        "quit",
+      ]
+      result = run_emu_dbg(argv,debugger_commands)
+      expect(result.any? { |line| line.include?("trace 0x06f1: [0xff44] = ") }).to be true
+      expect(result.any? { |line| line.start_with?("0x06f1 | ") }).to be true
+    end
+  end
+
+  describe 'control server' do
+    def control_batch(socket, commands)
+      socket.write([commands.bytesize].pack("V") + commands)
+      length = socket.read(4).unpack1("V")
+      socket.read(length)
+    end
+
+    it 'steps frames and reads memory in separate sessions' do
+      path = "log/control.sock"
+      argv = [
+        "bin/GBcon",
+        "--bios", "tests/resources/gb_bios.bin",
+        "--rom", "tests/resources/blarggs/cpu_instrs.gb",
+        "--control", path,
+      ]
+      pid = spawn(*argv, :out=>File::NULL)
+      begin
+        sleep 0.1 until File.socket?(path)
+        replies = 2.times.map do
+          UNIXSocket.open(path) do |socket|
+            # step 60 frames, read LY and fetch the frame
+            control_batch(socket, [1, 60].pack("CV") +
+                                  [3, 0xff44, 1].pack("Cvv") + [7].pack("C"))
+          end
+        end
+        status, frame, cycle = replies[0].unpack("CQ<Q<")
+        expect(status).to eq(0)
+        expect(frame).to eq(60)
+        expect(cycle).to be_between(60 * 70224, 61 * 70224)
+        expect(replies[0].bytesize).to eq(17 + 2 + 1 + 160 * 144)
+        # each session starts at power on, so both see the same machine
+        expect(replies[1]).to eq(replies[0])
+
+        UNIXSocket.open(path) do |socket|
+          reply = control_batch(socket, [3, 0xfff0, 0x20].pack("Cvv"))
+          expect(reply.bytes).to eq([2])
+        end
+      ensure
+        Process.kill("TERM", pid)
+        Process.wait(pid)
+      end
+      expect(File.exist?(path)).to be false
+    end
+  end
+
   describe 'command line arguement parsing' do
     it 'prints error when --rom arg missing' do
       argv = [
@@ -1,6 +1,7 @@
 #include "gb_cart.h"
 #include "gb_sdl.h"
 #include "gb_mbc.h"
+#include "gb_state.h"
 
 
 Cartridge::Cartridge(std::string rom_path) {
@@ -24,32 +25,42 @@ Cartridge::Cartridge(std::string rom_path) {
 
     cart_rom = new unsigned char[file_len];
     rom_file.read((char *)cart_rom, file_len);
+    rom_checksum = 2166136261u;
+    for (int i = 0; i < file_len; i++) {
+      rom_checksum = (rom_checksum ^ cart_rom[i]) * 16777619u;
+    }
 
     switch (cart_rom[Ram_size_addr]) {
     case 0x00: // ram size = 0. alloc anyways and fill with 0xFFs
       num_ram_banks = 0;
-      cart_ram = new unsigned char[One_KB * 8];
-      memset(cart_ram, 0xFF, One_KB * 8);
+      ram_size = One_KB * 8;
+      cart_ram = new unsigned char[ram_size];
+      memset(cart_ram, 0xFF, ram_size);
       break;
     case 0x01: // ram size = 2 Kbytes
       num_ram_banks = 1;
-      cart_ram = new unsigned char[One_KB * 2];
+      ram_size = One_KB * 2;
+      cart_ram = new unsigned char[ram_size];
       break;
     case 0x02: // ram size = 8 Kbytes
       num_ram_banks = 1;
-      cart_ram = new unsigned char[One_KB * 8];
+      ram_size = One_KB * 8;
+      cart_ram = new unsigned char[ram_size];
       break;
     case 0x03: // ram size = 32 Kbytes
       num_ram_banks = 4;
-      cart_ram = new unsigned char[One_KB * 32];
+      ram_size = One_KB * 32;
+      cart_ram = new unsigned char[ram_size];
       break;
     case 0x04: // ram size = 128 Kbytes
       num_ram_banks = 16;
-      cart_ram = new unsigned char[One_KB * 128];
+      ram_size = One_KB * 128;
+      cart_ram = new unsigned char[ram_size];
       break;
     case 0x05: // ram size = 64 Kbytes
       num_ram_banks = 8;
-      cart_ram = new unsigned char[One_KB * 64];
+      ram_size = One_KB * 64;
+      cart_ram = new unsigned char[ram_size];
       break;
     default:
       std::cerr << "GBcon: invalid ram size in cart header at 0x0147" << std::endl;
@@ -111,6 +122,10 @@ void Cartridge::write_byte(unsigned short address, unsigned char value) {
   mbc->write_byte(address, value);
 }
 
+unsigned short Cartridge::get_rom_bank(void) {
+  return mbc->get_rom_bank();
+}
+
 void Cartridge::import_sav(std::string path) {
   int file_len;
   std::ifstream sav_file;
@@ -161,3 +176,8 @@ Cartridge::~Cartridge() {
     delete cart_ram;
   }
 }
+
+void Cartridge::state(Snapshot &s) {
+  s.io_bytes(cart_ram, ram_size);
+  mbc->state(s);
+}
@@ -0,0 +1,323 @@
+#include "gb_control.h"
+#include "gb_cpu.h"
+#include "gb_joypad.h"
+#include "gb_lcd.h"
+#include "gb_memory.h"
+#include "gb_state.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t quit_server = 0;
+
+static void stop_server(int) { quit_server = 1; }
+
+/* little endian fields
+ */
+
+static unsigned long long get_le(const unsigned char *&in, unsigned int n) {
+  unsigned long long v = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    v |= (unsigned long long)*in++ << (8 * i);
+  }
+  return v;
+}
+
+static void put_le(std::vector<unsigned char> &out, unsigned long long v,
+                   unsigned int n) {
+  for (unsigned int i = 0; i < n; i++) {
+    out.push_back(v >> (8 * i));
+  }
+}
+
+static bool read_all(int fd, unsigned char *p, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const unsigned char *p, size_t len) {
+  while (len > 0) {
+    // a client that hung up is an error here, not a SIGPIPE
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+ControlServer::~ControlServer() { close(); }
+
+bool ControlServer::open(const std::string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "GBcon: control socket path is too long" << std::endl;
+    return false;
+  }
+  strcpy(addr.sun_path, path.c_str());
+
+  // a socket left behind by a server that's gone is replaced. a live one
+  // isn't
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe >= 0) {
+    if (connect(probe, (sockaddr *)&addr, sizeof(addr)) == 0) {
+      std::cerr << "GBcon: a server is already listening on " << path
+                << std::endl;
+      ::close(probe);
+      return false;
+    }
+    if (errno == ECONNREFUSED) {
+      unlink(path.c_str());
+    }
+    ::close(probe);
+  }
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, Max_Sessions) != 0) {
+    std::cerr << "GBcon: can't listen on " << path << ": " << strerror(errno)
+              << std::endl;
+    if (listen_fd >= 0) {
+      ::close(listen_fd);
+      listen_fd = -1;
+    }
+    return false;
+  }
+  this->path = path;
+  return true;
+}
+
+void ControlServer::close(void) {
+  if (listen_fd < 0) {
+    return;
+  }
+  ::close(listen_fd);
+  listen_fd = -1;
+  unlink(path.c_str());
+}
+
+void ControlServer::run(GB_Sys *gb_sys, SaveState *save_state,
+                        bool (*run_frame)(void)) {
+  sys = *gb_sys;
+  this->save_state = save_state;
+  this->run_frame = run_frame;
+
+  // no SA_RESTART, so poll returns to check quit_server
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_server;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  while (!quit_server) {
+    // the timeout reaps finished sessions while no one is connecting
+    pollfd p = {listen_fd, POLLIN, 0};
+    int ready = poll(&p, 1, 1000);
+    reap();
+    if (ready <= 0) {
+      continue;
+    }
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    if (sessions >= Max_Sessions) {
+      std::cerr << "GBcon: " << Max_Sessions
+                << " control sessions running, turned a client away"
+                << std::endl;
+      ::close(fd);
+      continue;
+    }
+
+    // the session starts with the machine as it is now, at power on
+    fflush(nullptr);
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      ::close(listen_fd);
+      listen_fd = -1;
+      serve(fd);
+      // skips the server's exit path (and unlinking its socket)
+      _exit(EXIT_SUCCESS);
+    }
+    ::close(fd);
+    if (pid < 0) {
+      std::cerr << "GBcon: can't start a control session: " << strerror(errno)
+                << std::endl;
+    } else {
+      sessions++;
+    }
+  }
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+}
+
+void ControlServer::reap(void) {
+  while (sessions > 0 && waitpid(-1, nullptr, WNOHANG) > 0) {
+    sessions--;
+  }
+}
+
+void ControlServer::serve(int fd) {
+  std::vector<unsigned char> batch, reply;
+  while (true) {
+    unsigned char header[4];
+    if (!read_all(fd, header, sizeof(header))) {
+      break;
+    }
+    const unsigned char *p = header;
+    size_t len = get_le(p, 4);
+    if (len > Max_Batch) {
+      std::cerr << "GBcon: control batch of " << len
+                << " bytes is too large, closing the session" << std::endl;
+      break;
+    }
+    batch.resize(len);
+    if (!read_all(fd, batch.data(), len)) {
+      break;
+    }
+
+    // the byte count goes in front once the results are in
+    reply.assign(4, 0);
+    run_batch(batch.data(), len, reply);
+    size_t reply_len = reply.size() - 4;
+    for (unsigned int i = 0; i < 4; i++) {
+      reply[i] = reply_len >> (8 * i);
+    }
+    if (!write_all(fd, reply.data(), reply.size())) {
+      break;
+    }
+  }
+  ::close(fd);
+}
+
+void ControlServer::run_batch(const unsigned char *in, size_t len,
+                              std::vector<unsigned char> &reply) {
+  const unsigned char *end = in + len;
+  while (in < end) {
+    size_t status_at = reply.size();
+    reply.push_back(Ctl_Ok);
+    Control_Status status = run_command(in, end, reply);
+    if (status != Ctl_Ok) {
+      // a failed command returns no data, and ends the batch
+      reply.resize(status_at + 1);
+      reply[status_at] = status;
+      return;
+    }
+  }
+}
+
+Control_Status ControlServer::run_command(const unsigned char *&in,
+                                          const unsigned char *end,
+                                          std::vector<unsigned char> &reply) {
+  unsigned char op = *in++;
+  size_t left = end - in;
+  switch (op) {
+  case Ctl_Step: {
+    if (left < 4) {
+      return Ctl_Bad_Command;
+    }
+    unsigned long frames = get_le(in, 4);
+    for (unsigned long i = 0; i < frames && !sys.cpu->stop; i++) {
+      run_frame();
+    }
+    if (sys.cpu->stop) {
+      return Ctl_Stopped;
+    }
+    put_le(reply, sys.lcd->frames, 8);
+    put_le(reply, sys.lcd->cycle(), 8);
+    return Ctl_Ok;
+  }
+
+  case Ctl_Input: {
+    if (left < 2) {
+      return Ctl_Bad_Command;
+    }
+    unsigned char buttons = *in++ & 0x0F;
+    unsigned char direction = *in++ & 0x0F;
+    sys.joypad->schedule(sys.lcd->cycle(), buttons, direction);
+    return Ctl_Ok;
+  }
+
+  case Ctl_Read:
+  case Ctl_Write: {
+    if (left < 4) {
+      return Ctl_Bad_Command;
+    }
+    unsigned int address = get_le(in, 2);
+    unsigned int len = get_le(in, 2);
+    if (op == Ctl_Write && left - 4 < len) {
+      return Ctl_Bad_Command;
+    }
+    if (address + len > 0x10000) {
+      return Ctl_Bad_Range;
+    }
+    for (unsigned int i = 0; i < len; i++) {
+      if (op == Ctl_Read) {
+        reply.push_back(sys.mem->peek_byte(address + i));
+      } else {
+        sys.mem->write_byte(address + i, *in++);
+      }
+    }
+    return Ctl_Ok;
+  }
+
+  case Ctl_Save: {
+    save_state->save();
+    const Snapshot &saved = save_state->saved();
+    put_le(reply, saved.size(), 4);
+    reply.insert(reply.end(), saved.bytes(), saved.bytes() + saved.size());
+    return Ctl_Ok;
+  }
+
+  case Ctl_Load: {
+    if (left < 4) {
+      return Ctl_Bad_Command;
+    }
+    size_t len = get_le(in, 4);
+    if (left - 4 < len) {
+      return Ctl_Bad_Command;
+    }
+    bool loaded = save_state->load_bytes(in, len);
+    in += len;
+    return loaded ? Ctl_Ok : Ctl_Bad_State;
+  }
+
+  case Ctl_Frame: {
+    const unsigned char *shades = sys.lcd->shades();
+    reply.insert(reply.end(), shades,
+                 shades + LCD::LCD_Width * LCD::LCD_Height);
+    return Ctl_Ok;
+  }
+
+  default:
+    return Ctl_Bad_Command;
+  }
+}
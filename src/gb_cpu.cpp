@@ -1,6 +1,11 @@
 #include "gb_cpu.h"
+#include "gb_state.h"
 #include "gb_int.h"
 #include "gb_memory.h"
+#include "gb_cart.h"
+#include "gb_trace.h"
+#include <cstdio>
+#include <cstring>
 
 using namespace std;
 
@@ -46,9 +51,28 @@ unsigned int CPU::cpu_step(void) {
     return instCycles;
   }
 
+  if (trace_writer) {
+    auto pc = registers.pc;
+    trace_writer->record(Trace_Entry{
+        registers.a, registers.f, registers.b, registers.c, registers.d,
+        registers.e, registers.h, registers.l, registers.sp, pc,
+        {mem->peek_byte(pc), mem->peek_byte(pc + 1), mem->peek_byte(pc + 2),
+         mem->peek_byte(pc + 3)}});
+  }
+
   // read instruction from mem
   curr_inst = mem->read_byte(registers.pc++);
 
+  // record state before executing
+  if (trace_ring_on) {
+    trace_ring.push_back(Trace_Record{
+        machine_cycle_counter, prev_pc,
+        (unsigned short)((prev_pc >= 0x4000 && prev_pc < 0x8000)
+                             ? cart->get_rom_bank() : 0),
+        registers.af, registers.bc, registers.de, registers.hl, registers.sp,
+        curr_inst});
+  }
+
   // execute
   (this->*(instrs[curr_inst].execute))();
 
@@ -127,8 +151,101 @@ void CPU::_unimplemented(void) {
   cout << "unimplemented opcode " << hex << unsigned(curr_inst) << endl;
   cout << instrs[curr_inst].disassembly << endl;
   cout << endl;
+  dump_trace(cerr);
   stop = true;
 }
+
+/* trace lines are built by hand rather than with snprintf, which isn't
+   async-signal-safe, so the crash handler can use them
+ */
+
+// at least digits digits, like %0*x
+static char *put_hex(char *p, unsigned long value, unsigned int digits) {
+  while (digits < 16 && (value >> (4 * digits)) != 0) {
+    digits++;
+  }
+  for (unsigned int i = digits; i > 0; i--) {
+    p[i - 1] = "0123456789abcdef"[value & 0xF];
+    value >>= 4;
+  }
+  return p + digits;
+}
+
+static char *put_dec(char *p, unsigned long value) {
+  char digits[20];
+  unsigned int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n > 0) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+static char *put_str(char *p, const char *str) {
+  size_t n = strlen(str);
+  memcpy(p, str, n);
+  return p + n;
+}
+
+int CPU::format_trace_record(char *buf, size_t len, const Trace_Record &t) {
+  // "bb:pppp  oo  disassembly    af=xxxx bc=xxxx de=xxxx hl=xxxx sp=xxxx
+  // cycle n". the disassembly is padded to 14 and cut at 64
+  char line[160];
+  char *p = put_hex(line, t.bank, 2);
+  *p++ = ':';
+  p = put_hex(p, t.pc, 4);
+  p = put_str(p, "  ");
+  p = put_hex(p, t.opcode, 2);
+  p = put_str(p, "  ");
+  const std::string &dis = instrs[t.opcode].disassembly;
+  size_t dis_len = std::min(dis.size(), (size_t)64);
+  memcpy(p, dis.data(), dis_len);
+  p += dis_len;
+  for (size_t i = dis_len; i < 14; i++) {
+    *p++ = ' ';
+  }
+  const char *names[] = {" af=", " bc=", " de=", " hl=", " sp="};
+  const unsigned short regs[] = {t.af, t.bc, t.de, t.hl, t.sp};
+  for (unsigned int i = 0; i < 5; i++) {
+    p = put_str(p, names[i]);
+    p = put_hex(p, regs[i], 4);
+  }
+  p = put_str(p, "  cycle ");
+  p = put_dec(p, t.cycle);
+  *p++ = '\n';
+
+  size_t n = std::min((size_t)(p - line), len - 1);
+  memcpy(buf, line, n);
+  buf[n] = '\0';
+  return n;
+}
+
+void CPU::dump_trace(std::ostream &out, size_t count) {
+  char line[128];
+  size_t skip = (trace_ring.size() > count) ? trace_ring.size() - count : 0;
+
+  out << "last " << std::dec << (trace_ring.size() - skip)
+      << " instructions (oldest first):\n";
+  for (auto it = trace_ring.begin() + skip; it != trace_ring.end(); it++) {
+    format_trace_record(line, sizeof(line), *it);
+    out << line;
+  }
+  out.flush();
+}
+
+void CPU::dump_trace_fd(int fd) {
+  // no allocation or iostreams. called from signal handlers
+  char line[128];
+  const char header[] = "last instructions (oldest first):\n";
+  (void)!write(fd, header, sizeof(header) - 1);
+  for (auto &t : trace_ring) {
+    int n = format_trace_record(line, sizeof(line), t);
+    (void)!write(fd, line, n);
+  }
+}
 // 0x00
 void CPU::nop(void) { ; }
 
@@ -2704,4 +2821,16 @@ void CPU::RST_38H(void) { // 0xff
 void CPU::init(GB_Sys *gb_sys) {
   mem = gb_sys->mem;
   interrupt = gb_sys->interrupt;
+  cart = gb_sys->cart;
+}
+
+void CPU::state(Snapshot &s) {
+  s.io(registers);
+  s.io(machine_cycle_counter);
+  s.io(stop);
+  s.io(halted);
+  s.io(branch_taken);
+  s.io(hl_temp_reg);
+  s.io(curr_inst);
+  s.io(prev_pc);
 }
@@ -1,12 +1,15 @@
 #include "gb_dbg.h"
 #include "gb_memory.h"
 #include "gb_util.h"
+#include <algorithm>
 #include <iostream>
 
 void Debug::run(void) {
+  attention = false;
+
   // check events
+  // (watchpoints are trapped by the memory bus and set stopped directly)
   stopped |= check_breakpoints();
-  stopped |= check_watchpoints();
   stopped |= step_resume;
 
   step_resume = false;
@@ -22,52 +25,120 @@ void Debug::run(void) {
     exec_dbg_command(argv);
   }
 
-  // append new serial data to buffer
-  if (mem->serial_tx_initd) {
-    serial_data.push_back(mem->serial_tx_data);
-    mem->serial_tx_initd = false;
-  }
+  // come back before the next instruction if stepping
+  attention = step_resume;
 }
 
 void Debug::init(GB_Sys *gb_sys) {
   cpu = gb_sys->cpu;
   mem = gb_sys->mem;
 
+  // started in the debugger
+  attention = stopped;
+
   // add commands
   add_command("help", &Debug::execute_help_cmd, "prints help message");
-  add_command("break", &Debug::execute_break_cmd, "sets breakpoint at address");
-//  add_command("watch", &Debug::execute_watch_cmd, "sets memory watchpoint at address");
+  add_command("break", &Debug::execute_break_cmd, "sets breakpoint. break addr [if cond]");
+  add_command("trace", &Debug::execute_trace_cmd, "logs expression at address. trace addr expr [if cond]");
+  add_command("watch", &Debug::execute_watch_cmd, "sets memory watchpoint. watch addr[-end] [r|w|rw|c]");
+  add_command("unwatch", &Debug::execute_unwatch_cmd, "removes watchpoint by number");
   add_command("continue", &Debug::execute_continue_cmd, "continue emulator execution");
   add_command("step", &Debug::execute_step_cmd, "execute a single instruction");
   add_command("examine", &Debug::execute_examine_cmd, "display memory contents");
+  add_command("last", &Debug::execute_last_cmd, "show last n executed instructions");
   //add_command("info", &Debug::execute_info_cmd, "prints name and values of registers");
   //add_command("reset", execute_reset_cmd,"reset emulator.");
   add_command("quit", &Debug::execute_quit_cmd, "quits emulator");
 }
 
 bool Debug::check_breakpoints(void) {
-  if (breakpoints.count(cpu->registers.pc)) {
-     if (breakpoints.at(cpu->registers.pc).enabled ) {
-       print_cpu_state();
-       return true;
-     }
-  } 
+  auto pc = cpu->registers.pc;
+  if (!break_traps[pc]) {
+    return false;
+  }
+
+  auto t = tracepoints.find(pc);
+  if (t != tracepoints.end() &&
+      (t->second.cond.empty() || t->second.cond.eval(cpu, mem))) {
+    int val = t->second.expr.eval(cpu, mem);
+    std::cout << "trace 0x" << hex << setfill('0') << setw(4) << pc << ": "
+              << t->second.expr.text << " = 0x" << hex << val << " ("
+              << std::dec << val << ")\n";
+  }
+
+  auto b = breakpoints.find(pc);
+  if (b != breakpoints.end() && b->second.enabled &&
+      (b->second.cond.empty() || b->second.cond.eval(cpu, mem))) {
+    cpu->dump_trace(std::cout, Trace_Lines_On_Break);
+    print_cpu_state();
+    return true;
+  }
   return false;
 }
 
-bool Debug::check_watchpoints(void) {
+void Debug::update_watch_traps(void) {
+  // rebuild the bus trap bitmaps from the watchpoint list. only done when the
+  // list changes, so the cost of a memory access doesn't depend on how many
+  // watchpoints are set
+  mem->read_traps.reset();
+  mem->write_traps.reset();
   for (auto &w : watchpoints) {
-    if (!w.second.enabled) {
+    if (!w.enabled) {
       continue;
     }
+    for (unsigned int a = w.start_addr; a <= w.end_addr; a++) {
+      if (w.type & WATCH_READ) {
+        mem->read_traps[a] = true;
+      }
+      if (w.type & (WATCH_WRITE | WATCH_CHANGE)) {
+        mem->write_traps[a] = true;
+      }
+    }
+  }
+  mem->traps_enabled = mem->read_traps.any() || mem->write_traps.any();
+}
 
-    if (mem->read_byte(w.second.addr) != w.second.prev_val) {
-      print_cpu_state();
-      return true;
+void Debug::read_trap(unsigned short addr) {
+  // ignore reads made while sitting at the prompt
+  if (stopped) {
+    return;
+  }
+  for (size_t i = 0; i < watchpoints.size(); i++) {
+    auto &w = watchpoints[i];
+    if (w.enabled && (w.type & WATCH_READ) &&
+        addr >= w.start_addr && addr <= w.end_addr) {
+      std::cout << "watchpoint " << std::dec << i << " hit: read 0x" << hex
+                << setfill('0') << setw(4) << addr << " = 0x" << setw(2)
+                << unsigned(mem->peek_byte(addr)) << " at pc 0x" << setw(4)
+                << cpu->prev_pc << "\n";
+      stopped = true;
+      attention = true;
+      return;
     }
   }
+}
 
-  return false;
+void Debug::write_trap(unsigned short addr, unsigned char value) {
+  if (stopped) {
+    return;
+  }
+  unsigned char prev_val = mem->peek_byte(addr);
+  for (size_t i = 0; i < watchpoints.size(); i++) {
+    auto &w = watchpoints[i];
+    if (!w.enabled || addr < w.start_addr || addr > w.end_addr) {
+      continue;
+    }
+    if ((w.type & WATCH_WRITE) ||
+        ((w.type & WATCH_CHANGE) && value != prev_val)) {
+      std::cout << "watchpoint " << std::dec << i << " hit: write 0x" << hex
+                << setfill('0') << setw(4) << addr << " 0x" << setw(2)
+                << unsigned(prev_val) << " -> 0x" << setw(2) << unsigned(value)
+                << " at pc 0x" << setw(4) << cpu->prev_pc << "\n";
+      stopped = true;
+      attention = true;
+      return;
+    }
+  }
 }
 
 void Debug::print_cpu_state(void) {
@@ -137,25 +208,118 @@ void Debug::execute_help_cmd(CmdArgs &argv) {
 }
 
 void Debug::execute_break_cmd(std::vector<std::string> &argv) {
-  // insert breakpoint if it doesn't already exist
+  // no args lists the breakpoints
+  if (argv.size() < 2) {
+    for (auto &b : breakpoints) {
+      std::cout << "0x" << hex << setfill('0') << setw(4) << b.first;
+      if (!b.second.cond.empty()) {
+        std::cout << " if " << b.second.cond.text;
+      }
+      std::cout << "\n";
+    }
+    return;
+  }
+
+  // break addr [if cond]
   auto addr = gb_util::stous(argv[1], nullptr, 0);
+  Breakpoint bp;
+  bp.enabled = true;
+  if (argv.size() > 2) {
+    if (argv[2] != "if" || argv.size() < 4) {
+      throw std::invalid_argument("break");
+    }
+    bp.cond.compile(gb_util::join(argv, 3, argv.size(), ' '));
+  }
+
+  // insert breakpoint if it doesn't already exist
   if (breakpoints.count(addr)) {
     std::cout << "breakpoint exists\n";
   } else {
-    breakpoints.insert({addr, Breakpoint{.enabled = true}});
+    breakpoints.insert({addr, bp});
+    break_traps[addr] = true;
     cout << "breakpoint set\n";
   }
 }
 
-void Debug::execute_watch_cmd(std::vector<std::string> &argv) {
-  // insert watchpoint if it doesn't already exist
+void Debug::execute_trace_cmd(std::vector<std::string> &argv) {
+  // trace addr expr [if cond]
+  if (argv.size() < 3) {
+    throw std::invalid_argument("trace");
+  }
   auto addr = gb_util::stous(argv[1], nullptr, 0);
-  if (watchpoints.count(addr)) {
-    std::cout << "watchpoint exists\n";
+  auto if_pos = std::find(argv.begin() + 2, argv.end(), "if") - argv.begin();
+
+  Tracepoint tp;
+  tp.expr.compile(gb_util::join(argv, 2, if_pos, ' '));
+  if ((size_t)if_pos != argv.size()) {
+    tp.cond.compile(gb_util::join(argv, if_pos + 1, argv.size(), ' '));
+  }
+
+  tracepoints[addr] = tp;
+  break_traps[addr] = true;
+  cout << "tracepoint set\n";
+}
+
+void Debug::print_watchpoint(size_t index) {
+  auto &w = watchpoints[index];
+  std::cout << std::dec << index << ": 0x" << hex << setfill('0') << setw(4)
+            << w.start_addr;
+  if (w.end_addr != w.start_addr) {
+    std::cout << "-0x" << setw(4) << w.end_addr;
+  }
+  std::cout << " " << ((w.type & WATCH_READ) ? "r" : "")
+            << ((w.type & WATCH_WRITE) ? "w" : "")
+            << ((w.type & WATCH_CHANGE) ? "c" : "") << "\n";
+}
+
+void Debug::execute_watch_cmd(std::vector<std::string> &argv) {
+  // no args lists the watchpoints
+  if (argv.size() < 2) {
+    for (size_t i = 0; i < watchpoints.size(); i++) {
+      print_watchpoint(i);
+    }
+    return;
+  }
+
+  // address or address range. e.g. 0xc000 or 0xc000-0xc0ff
+  auto range = gb_util::split(argv[1], '-');
+  Watchpoint w;
+  w.start_addr = gb_util::stous(range.at(0), nullptr, 0);
+  w.end_addr = (range.size() > 1) ? gb_util::stous(range[1], nullptr, 0)
+                                  : w.start_addr;
+  if (w.end_addr < w.start_addr) {
+    throw std::invalid_argument("watch");
+  }
+
+  // access type. defaults to writes
+  std::string type = (argv.size() > 2) ? argv[2] : "w";
+  if (type == "r") {
+    w.type = WATCH_READ;
+  } else if (type == "w") {
+    w.type = WATCH_WRITE;
+  } else if (type == "rw") {
+    w.type = WATCH_READ | WATCH_WRITE;
+  } else if (type == "c") {
+    w.type = WATCH_CHANGE;
   } else {
-    watchpoints.insert({addr, Watchpoint{.addr=addr, .prev_val=0x00, .enabled = true}});
-    cout << "watchpoint set\n";
+    throw std::invalid_argument("watch");
   }
+  w.enabled = true;
+
+  watchpoints.push_back(w);
+  update_watch_traps();
+  cout << "watchpoint set\n";
+  print_watchpoint(watchpoints.size() - 1);
+}
+
+void Debug::execute_unwatch_cmd(std::vector<std::string> &argv) {
+  size_t index = std::stoul(argv.at(1), nullptr, 0);
+  if (index >= watchpoints.size()) {
+    throw std::out_of_range("unwatch");
+  }
+  watchpoints.erase(watchpoints.begin() + index);
+  update_watch_traps();
+  cout << "watchpoint removed\n";
 }
 
 void Debug::execute_continue_cmd(std::vector<std::string> &argv) {
@@ -180,6 +344,14 @@ void Debug::execute_examine_cmd(std::vector<std::string> &argv) {
   mem->print_memory_range(addr, blocks);
 }
 
+void Debug::execute_last_cmd(std::vector<std::string> &argv) {
+  size_t count = CPU::Trace_Length;
+  if (argv.size() > 1) {
+    count = std::stoul(argv[1], nullptr, 0);
+  }
+  cpu->dump_trace(std::cout, count);
+}
+
 // TODO(connor): info command with lcd, cpu, and mem modifiers
 //void Debug::execute_info_cmd(std::vector<std::string> &argv) {}
 
@@ -191,9 +363,3 @@ void Debug::execute_quit_cmd(std::vector<std::string> &argv) {
   cpu->stop = true;
   stopped = false;
 }
-
-void Debug::write_serial_log_file(std::string filepath) {
-  std::ofstream out(filepath, std::ofstream::out | std::ofstream::trunc);
-  for (const auto &c : serial_data ) out << char(c); 
-  out << "\0";
-}
@@ -0,0 +1,274 @@
+#include "gb_dbg_expr.h"
+#include "gb_cpu.h"
+#include "gb_memory.h"
+#include <cctype>
+#include <stdexcept>
+
+static const char *Reg_Names[] = {"a", "f", "b", "c", "d", "e", "h",
+                                  "l", "af", "bc", "de", "hl", "sp", "pc"};
+static const char *Flag_Names[] = {"zf", "nf", "hf", "cf"};
+
+void DebugExpr::compile(const std::string &s) {
+  text = s;
+  code.clear();
+  tokenize(s);
+  pos = 0;
+  depth = max_depth = 0;
+
+  parse_log_or();
+  if (pos != tokens.size() || max_depth > Max_Stack) {
+    code.clear();
+    throw std::invalid_argument("expression");
+  }
+}
+
+void DebugExpr::tokenize(const std::string &s) {
+  // longest operators first so "<=" isn't read as "<" "="
+  static const char *Ops[] = {"&&", "||", "==", "!=", "<=", ">=", "<", ">",
+                              "!",  "~",  "-",  "+",  "&",  "^",  "|", "(",
+                              ")",  "[",  "]"};
+  tokens.clear();
+  size_t i = 0;
+  while (i < s.size()) {
+    if (isspace(s[i])) {
+      i++;
+    } else if (isalnum(s[i])) {
+      size_t j = i;
+      while (j < s.size() && isalnum(s[j])) {
+        j++;
+      }
+      tokens.push_back(s.substr(i, j - i));
+      i = j;
+    } else {
+      bool found = false;
+      for (auto op : Ops) {
+        if (s.compare(i, std::string(op).size(), op) == 0) {
+          tokens.push_back(op);
+          i += std::string(op).size();
+          found = true;
+          break;
+        }
+      }
+      if (!found) {
+        throw std::invalid_argument("expression");
+      }
+    }
+  }
+}
+
+bool DebugExpr::accept(const char *tok) {
+  if (pos < tokens.size() && tokens[pos] == tok) {
+    pos++;
+    return true;
+  }
+  return false;
+}
+
+void DebugExpr::emit(Op op, unsigned short arg) {
+  code.push_back(Inst{op, arg});
+  if (op == PUSH_IMM || op == PUSH_REG || op == PUSH_FLAG) {
+    depth++;
+  } else if (op >= ADD) {
+    depth--; // binary ops pop two, push one
+  }
+  if (depth > max_depth) {
+    max_depth = depth;
+  }
+}
+
+void DebugExpr::parse_log_or(void) {
+  parse_log_and();
+  while (accept("||")) {
+    parse_log_and();
+    emit(LOG_OR);
+  }
+}
+
+void DebugExpr::parse_log_and(void) {
+  parse_compare();
+  while (accept("&&")) {
+    parse_compare();
+    emit(LOG_AND);
+  }
+}
+
+void DebugExpr::parse_compare(void) {
+  parse_bit_or();
+  if (accept("==")) {
+    parse_bit_or();
+    emit(EQ);
+  } else if (accept("!=")) {
+    parse_bit_or();
+    emit(NE);
+  } else if (accept("<=")) {
+    parse_bit_or();
+    emit(LE);
+  } else if (accept(">=")) {
+    parse_bit_or();
+    emit(GE);
+  } else if (accept("<")) {
+    parse_bit_or();
+    emit(LT);
+  } else if (accept(">")) {
+    parse_bit_or();
+    emit(GT);
+  }
+}
+
+void DebugExpr::parse_bit_or(void) {
+  parse_bit_xor();
+  while (accept("|")) {
+    parse_bit_xor();
+    emit(OR);
+  }
+}
+
+void DebugExpr::parse_bit_xor(void) {
+  parse_bit_and();
+  while (accept("^")) {
+    parse_bit_and();
+    emit(XOR);
+  }
+}
+
+void DebugExpr::parse_bit_and(void) {
+  parse_sum();
+  while (accept("&")) {
+    parse_sum();
+    emit(AND);
+  }
+}
+
+void DebugExpr::parse_sum(void) {
+  parse_unary();
+  while (true) {
+    if (accept("+")) {
+      parse_unary();
+      emit(ADD);
+    } else if (accept("-")) {
+      parse_unary();
+      emit(SUB);
+    } else {
+      break;
+    }
+  }
+}
+
+void DebugExpr::parse_unary(void) {
+  if (accept("!")) {
+    parse_unary();
+    emit(NOT);
+  } else if (accept("~")) {
+    parse_unary();
+    emit(BIT_NOT);
+  } else if (accept("-")) {
+    parse_unary();
+    emit(NEG);
+  } else {
+    parse_primary();
+  }
+}
+
+void DebugExpr::parse_primary(void) {
+  if (accept("(")) {
+    parse_log_or();
+    if (!accept(")")) {
+      throw std::invalid_argument("expression");
+    }
+    return;
+  }
+  if (accept("[")) {
+    parse_log_or();
+    if (!accept("]")) {
+      throw std::invalid_argument("expression");
+    }
+    emit(LOAD_MEM);
+    return;
+  }
+  if (pos >= tokens.size()) {
+    throw std::invalid_argument("expression");
+  }
+
+  const std::string &tok = tokens[pos++];
+  if (isdigit(tok[0])) {
+    size_t idx;
+    unsigned long val = std::stoul(tok, &idx, 0);
+    if (idx != tok.size() || val > 0xFFFF) {
+      throw std::invalid_argument("expression");
+    }
+    emit(PUSH_IMM, val);
+    return;
+  }
+  for (unsigned short i = 0; i < sizeof(Reg_Names) / sizeof(Reg_Names[0]); i++) {
+    if (tok == Reg_Names[i]) {
+      emit(PUSH_REG, i);
+      return;
+    }
+  }
+  for (unsigned short i = 0; i < sizeof(Flag_Names) / sizeof(Flag_Names[0]); i++) {
+    if (tok == Flag_Names[i]) {
+      emit(PUSH_FLAG, i);
+      return;
+    }
+  }
+  throw std::invalid_argument("expression");
+}
+
+int DebugExpr::eval(CPU *cpu, Memory *mem) const {
+  int stack[Max_Stack];
+  int sp = 0;
+  auto &r = cpu->registers;
+
+  for (auto &inst : code) {
+    switch (inst.op) {
+    case PUSH_IMM:
+      stack[sp++] = inst.arg;
+      break;
+    case PUSH_REG: {
+      const int regs[] = {r.a,  r.f,  r.b,  r.c,  r.d,  r.e,  r.h,
+                          r.l,  r.af, r.bc, r.de, r.hl, r.sp, r.pc};
+      stack[sp++] = regs[inst.arg];
+      break;
+    }
+    case PUSH_FLAG:
+      stack[sp++] = !!(r.f & (0x80 >> inst.arg));
+      break;
+    case LOAD_MEM:
+      stack[sp - 1] = mem->peek_byte(stack[sp - 1] & 0xFFFF);
+      break;
+    case NOT:
+      stack[sp - 1] = !stack[sp - 1];
+      break;
+    case BIT_NOT:
+      stack[sp - 1] = ~stack[sp - 1];
+      break;
+    case NEG:
+      stack[sp - 1] = -stack[sp - 1];
+      break;
+    default: {
+      // binary operators
+      int rhs = stack[--sp];
+      int &lhs = stack[sp - 1];
+      switch (inst.op) {
+      case ADD:     lhs = lhs + rhs;  break;
+      case SUB:     lhs = lhs - rhs;  break;
+      case AND:     lhs = lhs & rhs;  break;
+      case XOR:     lhs = lhs ^ rhs;  break;
+      case OR:      lhs = lhs | rhs;  break;
+      case EQ:      lhs = lhs == rhs; break;
+      case NE:      lhs = lhs != rhs; break;
+      case LT:      lhs = lhs < rhs;  break;
+      case LE:      lhs = lhs <= rhs; break;
+      case GT:      lhs = lhs > rhs;  break;
+      case GE:      lhs = lhs >= rhs; break;
+      case LOG_AND: lhs = lhs && rhs; break;
+      case LOG_OR:  lhs = lhs || rhs; break;
+      default:
+        break;
+      }
+    }
+    }
+  }
+
+  return sp ? stack[0] : 0;
+}
@@ -1,6 +1,7 @@
 #include "gb_int.h"
 #include "gb_cpu.h"
 #include "gb_memory.h"
+#include "gb_state.h"
 
 void Interrupt::vblank(void) {
   mem->write_short_to_stack(cpu->registers.sp, cpu->registers.pc);
@@ -34,14 +35,11 @@ void Interrupt::sio_tx(void) {
   //    cpu->registers.pc = 0x0058;
 }
 void Interrupt::hi_lo(void) {
-  std::cout << "unimplemented hilo int" << std::endl;
-  cpu->stop = true;
+  mem->write_short_to_stack(cpu->registers.sp, cpu->registers.pc);
+  cpu->registers.sp -= 2;
 
-//  mem->write_short_to_stack(cpu->registers.sp, cpu->registers.pc);
-//  cpu->registers.sp -= 2;
-//
-//  //jump to hilo p10-p13
-//  cpu->registers.pc = 0x0060;
+  // jump to hilo p10-p13 irq (raised by Joypad)
+  cpu->registers.pc = 0x0060;
 }
 
 void Interrupt::step(void) {
@@ -79,3 +77,9 @@ void Interrupt::init(GB_Sys *gb_sys) {
   mem = gb_sys->mem;
   cpu = gb_sys->cpu;
 }
+
+void Interrupt::state(Snapshot &s) {
+  s.io(flags);
+  s.io(en);
+  s.io(ime_flag);
+}
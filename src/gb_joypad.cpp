@@ -0,0 +1,211 @@
+#include "gb_joypad.h"
+#include "gb_int.h"
+#include "gb_lcd.h"
+#include "gb_memory.h"
+#include "gb_state.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+unsigned char buttons;
+unsigned char direction;
+
+// bit layout of buttons/direction
+static const char *Button_Names[4] = {"a", "b", "select", "start"};
+static const char *Direction_Names[4] = {"right", "left", "up", "down"};
+
+/* Joypad
+ */
+
+Joypad::~Joypad() {
+  if (record_file != nullptr) {
+    fclose(record_file);
+  }
+}
+
+void Joypad::init(GB_Sys *gb_sys) {
+  mem = gb_sys->mem;
+  interrupt = gb_sys->interrupt;
+}
+
+void Joypad::schedule(unsigned long long cycle, unsigned char buttons,
+                      unsigned char direction) {
+  Pending change = {cycle, buttons, direction};
+  // after anything already queued for the same cycle
+  auto pos = std::upper_bound(
+      queue.begin(), queue.end(), change,
+      [](const Pending &a, const Pending &b) { return a.cycle < b.cycle; });
+  queue.insert(pos, change);
+  next_cycle = queue.front().cycle;
+}
+
+void Joypad::schedule_frame(const std::vector<Input_Change> &changes,
+                            unsigned long long frame_start,
+                            std::chrono::steady_clock::time_point host_start,
+                            std::chrono::steady_clock::time_point host_end) {
+  double span = std::chrono::duration<double>(host_end - host_start).count();
+  for (const Input_Change &c : changes) {
+    double at = 0;
+    if (span > 0) {
+      at = std::chrono::duration<double>(c.time - host_start).count() / span;
+      at = std::min(std::max(at, 0.0), 1.0);
+    }
+    unsigned long long cycle =
+        frame_start + (unsigned long long)(at * (LCD::Cycles_Per_Frame - 1));
+    schedule(cycle, c.buttons, c.direction);
+  }
+}
+
+void Joypad::apply(unsigned long long cycle) {
+  while (!queue.empty() && queue.front().cycle <= cycle) {
+    const Pending &change = queue.front();
+
+    // a newly pressed key pulls its P1 line low, which interrupts if that
+    // group is selected. P15 (bit 5) selects buttons, P14 (bit 4) directions
+    unsigned char p1 = mem->ioram[0x00];
+    if (((change.buttons & ~buttons) && !(p1 & 0x20)) ||
+        ((change.direction & ~direction) && !(p1 & 0x10))) {
+      interrupt->flags |= Interrupt::HI_LO;
+    }
+    buttons = change.buttons;
+    direction = change.direction;
+
+    if (record_file != nullptr && recording) {
+      fprintf(record_file, "%llu:%llu",
+              change.cycle / LCD::Cycles_Per_Frame,
+              change.cycle % LCD::Cycles_Per_Frame);
+      for (int i = 0; i < 4; i++) {
+        if (buttons & (1 << i)) {
+          fprintf(record_file, " %s", Button_Names[i]);
+        }
+        if (direction & (1 << i)) {
+          fprintf(record_file, " %s", Direction_Names[i]);
+        }
+      }
+      fprintf(record_file, "%s\n", (buttons | direction) ? "" : " none");
+    }
+    queue.pop_front();
+  }
+  next_cycle = queue.empty() ? ULLONG_MAX : queue.front().cycle;
+}
+
+bool Joypad::record(const std::string &path) {
+  record_file = fopen(path.c_str(), "w");
+  if (record_file == nullptr) {
+    std::cerr << "GBcon: can't open " << path << " to record input"
+              << std::endl;
+    return false;
+  }
+  fprintf(record_file, "# GBcon input recording. frame:clock keys\n");
+  return true;
+}
+
+void Joypad::close(unsigned long frames) {
+  if (record_file != nullptr) {
+    fprintf(record_file, "%lu quit\n", frames);
+    fclose(record_file);
+    record_file = nullptr;
+  }
+}
+
+void Joypad::state(Snapshot &s) {
+  s.io(buttons);
+  s.io(direction);
+  size_t queued = queue.size();
+  s.io(queued);
+  if (s.is_loading()) {
+    if (!s.expect(queued, sizeof(Pending))) {
+      queued = 0;
+    }
+    queue.resize(queued);
+  }
+  for (Pending &change : queue) {
+    s.io(change);
+  }
+  next_cycle = queue.empty() ? ULLONG_MAX : queue.front().cycle;
+}
+
+/* InputScript
+ */
+
+bool InputScript::load(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    std::cerr << "GBcon: can't open input script " << path << std::endl;
+    return false;
+  }
+
+  std::string line;
+  unsigned int line_num = 0;
+  while (std::getline(in, line)) {
+    line_num++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::string when;
+    if (!(words >> when)) {
+      continue;
+    }
+
+    // frame[:clock]
+    Step step = {0, 0, 0, 0};
+    char *end;
+    step.frame = strtoul(when.c_str(), &end, 10);
+    if (*end == ':') {
+      step.clock = strtoul(end + 1, &end, 10);
+    }
+    if (end == when.c_str() || *end != '\0' ||
+        step.clock >= LCD::Cycles_Per_Frame) {
+      std::cerr << "GBcon: " << path << ":" << line_num
+                << ": expected frame or frame:clock" << std::endl;
+      return false;
+    }
+
+    bool keys = false;
+    std::string key;
+    while (words >> key) {
+      bool found = false;
+      for (int i = 0; i < 4; i++) {
+        if (key == Button_Names[i]) {
+          step.buttons |= 1 << i;
+          found = true;
+        } else if (key == Direction_Names[i]) {
+          step.direction |= 1 << i;
+          found = true;
+        }
+      }
+      if (key == "quit") {
+        quit_frame = std::min(quit_frame, step.frame);
+        continue;
+      }
+      if (!found && key != "none") {
+        std::cerr << "GBcon: " << path << ":" << line_num << ": unknown key "
+                  << key << std::endl;
+        return false;
+      }
+      keys = true;
+    }
+    if (!keys) {
+      continue;
+    }
+    if (!steps.empty() &&
+        (step.frame < steps.back().frame ||
+         (step.frame == steps.back().frame &&
+          step.clock < steps.back().clock))) {
+      std::cerr << "GBcon: " << path << ":" << line_num
+                << ": frames must be in order" << std::endl;
+      return false;
+    }
+    steps.push_back(step);
+  }
+  return true;
+}
+
+void InputScript::schedule(Joypad *joypad) {
+  for (const Step &step : steps) {
+    joypad->schedule(
+        (unsigned long long)step.frame * LCD::Cycles_Per_Frame + step.clock,
+        step.buttons, step.direction);
+  }
+}
@@ -1,10 +1,10 @@
 #include "gb_lcd.h"
 #include "gb_int.h"
 #include "gb_memory.h"
-#include "gb_sdl.h"
-#include "SDL.h"
-#include <algorithm>
-#include <cassert>
+#include "gb_record.h"
+#include "gb_shm.h"
+#include "gb_state.h"
+#include "gb_video.h"
 
 /* LCD register getters / setters
  */
@@ -69,6 +69,9 @@ unsigned char LCD::get_wx() {
 }
 
 void LCD::set_lcdc(unsigned char value) {
+  if (get_lcdc() != value) {
+    ppu_generation++;
+  }
   control.bg_window_enabled  = !!(value & (1 << 0));
   control.sprites_enabled    = !!(value & (1 << 1));
   control.sprite_size        = !!(value & (1 << 2));
@@ -80,19 +83,25 @@ void LCD::set_lcdc(unsigned char value) {
 }
 
 void LCD::set_stat(unsigned char value) {
-  status.mode              = (Screen_Mode) (value & 0x03);
-  status.y_compare         = !!(value & (1 << 2));
+  // mode and LY=LYC bits are read only
   status.mode0_enable      = !!(value & (1 << 3));
   status.mode1_enable      = !!(value & (1 << 4));
   status.mode2_enable      = !!(value & (1 << 5));
   status.y_compare_enable  = !!(value & (1 << 6));
+  update_stat_line();
 }
 
 void LCD::set_scy(unsigned char value) {
+  if (scy != value) {
+    ppu_generation++;
+  }
   scy = value;
 }
 
 void LCD::set_scx(unsigned char value) {
+  if (scx != value) {
+    ppu_generation++;
+  }
   scx = value;
 }
 
@@ -102,9 +111,14 @@ void LCD::set_ly(unsigned char value) {
 
 void LCD::set_lyc(unsigned char value) {
   lyc = value;
+  status.y_compare = (ly == lyc);
+  update_stat_line();
 }
 
 void LCD::set_bgp(unsigned char value) {
+  if (get_bgp() != value) {
+    ppu_generation++;
+  }
   bgp.dot_palette[0] = ((value >> 0) & 0x03);
   bgp.dot_palette[1] = ((value >> 2) & 0x03);
   bgp.dot_palette[2] = ((value >> 4) & 0x03);
@@ -112,6 +126,9 @@ void LCD::set_bgp(unsigned char value) {
 }
 
 void LCD::set_obp0(unsigned char value) {
+  if (get_obp0() != value) {
+    ppu_generation++;
+  }
   obp0.dot_palette[0] = ((value >> 0) & 0x03);
   obp0.dot_palette[1] = ((value >> 2) & 0x03);
   obp0.dot_palette[2] = ((value >> 4) & 0x03);
@@ -119,6 +136,9 @@ void LCD::set_obp0(unsigned char value) {
 }
 
 void LCD::set_obp1(unsigned char value) {
+  if (get_obp1() != value) {
+    ppu_generation++;
+  }
   obp1.dot_palette[0] = ((value >> 0) & 0x03);
   obp1.dot_palette[1] = ((value >> 2) & 0x03);
   obp1.dot_palette[2] = ((value >> 4) & 0x03);
@@ -126,302 +146,299 @@ void LCD::set_obp1(unsigned char value) {
 }
 
 void LCD::set_wy(unsigned char value) {
+  if (wy != value) {
+    ppu_generation++;
+  }
   wy = value;
 }
 
 void LCD::set_wx(unsigned char value) {
+  if (wx != value) {
+    ppu_generation++;
+  }
   wx = value;
 }
 
 /* LCD driver 
  */
 
-inline void LCD::set_pixel(unsigned char x, unsigned char y, unsigned char gb_color_num) {
-  gb_pixels[x + y * LCD_Width] = gb_color_num;
+void LCD::vram_written(unsigned short address, unsigned char value) {
+  ppu_generation++;
+  if (threaded_render) {
+    render_thread.write_vram(address - 0x8000, value);
+  } else {
+    renderer.write_vram(address - 0x8000, value);
+  }
 }
 
-inline unsigned char LCD::get_pixel(unsigned char x, unsigned char y) {
-  return gb_pixels[x + y * LCD_Width];
+void LCD::oam_written(unsigned short address, unsigned char value) {
+  ppu_generation++;
+  if (threaded_render) {
+    render_thread.write_oam(address - 0xFE00, value);
+  } else {
+    renderer.write_oam(address - 0xFE00, value);
+  }
 }
 
-void LCD::search_sprites(unsigned char line) {
-  // FIXME - resolve sprite conflicts b/w between sprites w/ different x values
-
-  // read sprites from mem
-  for (int i = 0; i < Num_Sprites; i++) {
-    sprites[i].y_pos    = mem->read_byte(mem->Oram_Addr + i*4 + 0) - 16;
-    sprites[i].x_pos    = mem->read_byte(mem->Oram_Addr + i*4 + 1) - 8;
-    sprites[i].tile_num = mem->read_byte(mem->Oram_Addr + i*4 + 2);
-    sprites[i].attr     = mem->read_byte(mem->Oram_Addr + i*4 + 3);
-
-    // emulator metadata
-    sprites[i].meta.oram_addr = mem->Oram_Addr + i*4;
+void LCD::draw_line(unsigned char line) {
+  if (skip_frame || !draw_frames) {
+    return;
+  }
+  Renderer::Regs regs = {get_lcdc(), scy,        scx,        wy,
+                         wx,         get_bgp(), get_obp0(), get_obp1()};
+  if (threaded_render) {
+    render_thread.draw_line(line, regs, ppu_generation);
+  } else {
+    renderer.draw_line(line, regs, ppu_generation);
   }
+}
 
-  // sort by x position
-  std::sort(&sprites[0], &sprites[Num_Sprites-1],
-      [](const Sprite& a, const Sprite& b) {return a.x_pos < b.x_pos;});
-
-  // find up to 10 sprites this line
-  Sprite *sp = sprites;
-  sprites_this_line = 0;
-  int count = 0;
-  while (count < Num_Sprites) {
-    if (line >= sp->y_pos && line < sp->y_pos + 8 + 8 * (control.sprite_size)) {
-      sprites[count].meta.in_line_range = true;
-      if (sprites_this_line < 10) {
-        display_sprites[sprites_this_line++] = sp;
-      }
-    } else {
-      sprites[count].meta.in_line_range = false;
-    }
-    count++;
-    sp++;
+void LCD::present_frame(bool changed) {
+  if (!changed) {
+    frames_unchanged++;
+  } else if (threaded_render) {
+    video->present_pixels(renderer.argb);
+  } else {
+    video->present_frame();
   }
 }
 
-void LCD::draw_sprites(unsigned char line) {
+void LCD::record_frame(void) {
+  if (recorder != nullptr) {
+    recorder->push(renderer.shades());
+  }
+}
 
-  for (int i = 0; i < sprites_this_line; i++) {
-    Sprite *sp = display_sprites[i];
+void LCD::publish_frame(unsigned long frame) {
+  if (shm != nullptr) {
+    unsigned long long vblank =
+        (unsigned long long)frame * Cycles_Per_Frame +
+        LCD_Height * Cycles_Per_Line;
+    shm->publish(renderer.shades(), frame, vblank);
+  }
+}
 
-    unsigned short sprite_row;
-    if (sp->attr & Sprite_Attr_Masks.Y_Flip) {
-      unsigned char size = 8 + 8*!!(control.sprite_size) - 1;
-//    unsigned char size = 8 + 8*!!(control.sprite_size);
-      sprite_row = size - (line - sp->y_pos);
-    } else {
-      sprite_row = line - sp->y_pos;
+void LCD::close(void) {
+  if (threaded_render) {
+    bool changed = render_thread.finish_frame();
+    if (!render_skipped) {
+      publish_frame(frames - 1);
+      record_frame();
+      present_frame(changed);
     }
+    render_thread.close();
+  }
+}
 
-    OBP *pal_ptr;
-    if (sp->attr & Sprite_Attr_Masks.Palette) {
-      pal_ptr = &obp1;
-    } else {
-      pal_ptr = &obp0;
-    }
+/* PPU timing. each mode boundary of a line is an event at a known cycle of
+   the frame (cycle timing info comes from TCAGBD 8.*.1 'Timings in DMG').
+   step() just counts cycles until the next one
+ */
 
-    // read 1 line (2-bytes) of pixel data from tiledata table
-    unsigned short tiledata_addr = 0x8000 + sp->tile_num*16 + sprite_row*2;
-
-    unsigned char tiledata_msb = mem->read_byte(tiledata_addr);
-    unsigned char tiledata_lsb = mem->read_byte(tiledata_addr + 1);
-     
-    // set the pixels
-    for (unsigned char j = 0; j < 8; j++) {
-      // account for x flip
-      unsigned char j_flip = sp->attr & Sprite_Attr_Masks.X_Flip ? (7 - j) : j;
-
-      // check if pixel x pos is on screen
-      if ( sp->x_pos + j >= LCD_Width || sp->x_pos + j_flip < 0) {
-        sp->meta.in_screen_x = false;
-        continue;
-      }
-      sp->meta.in_screen_x = true;
-
-      // get pixel's palette number 
-      unsigned char mask = (0x80 >> j_flip);
-      unsigned char pal_num = !!(tiledata_msb & mask) + 2*!!(tiledata_lsb & mask);
-      // sprite color number 0 is always transparent
-      if (pal_num == pal_ptr->dot_palette[0]) {
-        continue;
-      }
+void LCD::start_line(unsigned char line) {
+  ly = line;
 
-      // check OBJ-to-BG flag (only render over BG color 0)
-      if (sp->attr & Sprite_Attr_Masks.Priority) {
-        unsigned pixel_col = get_pixel(sp->x_pos + j, line);
-        if ( pixel_col != bgp.dot_palette[0]) {
-          continue;
-        }
-      }
+  status.y_compare = (ly == lyc);
 
-      // set pixel
-      unsigned char color = pal_ptr->dot_palette[pal_num];
-      set_pixel(sp->x_pos + j, line, color); // note: not j_flip
+  if (ly < LCD_Height) {
+    // Mode 2
+    status.mode = SEARCH_OAM;
+    next_event += Oam_Search_Cycles;
+  } else {
+    if (ly == LCD_Height) {
+      // Mode 1 - vblank
+      status.mode = VBLANK;
+      interrupt->flags |= Interrupt::VBLANK;
+      // the last line is drawn, so readers can have the frame now
+      if (!threaded_render && draw_frames && !skip_frame) {
+        publish_frame(frames);
+      }
     }
+    next_event += Cycles_Per_Line;
   }
+  update_stat_line();
 }
 
-void LCD::draw_window(unsigned char line) {
-  // window enabled?
-  if (!control.window_enable) {
-    return;
-  }
-  // line with window offset outside LCD display?
-  if (!(line > wy && line - wy < LCD_Height)) {
-    return;
+void LCD::update_stat_line(void) {
+  // the enabled STAT sources are ORed into one line. the interrupt is only
+  // requested when it goes high, so a source that stays active (or a second
+  // one becoming active) doesn't interrupt again
+  bool line = (status.y_compare_enable && status.y_compare) ||
+              (status.mode0_enable && status.mode == HBLANK) ||
+              (status.mode1_enable && status.mode == VBLANK) ||
+              (status.mode2_enable && status.mode == SEARCH_OAM);
+  if (line && !stat_line) {
+    interrupt->flags |= Interrupt::LCDC_STAT;
   }
+  stat_line = line;
+}
 
-  unsigned short tilemap_base;
-  if (control.window_tile_map) {
-    tilemap_base = 0x9c00;
+bool LCD::should_skip(double speed, bool paced) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (!skip_frame) {
+    last_shown = now;
+    skip_run = 0;
   } else {
-    tilemap_base = 0x9800;
+    skip_run++;
   }
-  
-  unsigned short y = (line - wy);
-//cout << "tilemap_row " << tilemap_row << endl;
-  // render line for one tile
-  for (int i = 0; i < LCD_Width/8; i++) {
-    // lookup tilenumber in tilemap
-    unsigned short x = i * 8;
-    unsigned short tilemap_offset = (y / 8) * 32 + x / 8;
-
-    unsigned char tilenum = mem->read_byte(tilemap_base + tilemap_offset);
-//  cout << "tilemap lookup " << hex << (tilemap_base + tilemap_offset) << endl;
-
-    // read 2-bytes of pixel data from tiledata table
-    // (only reading 1/8 of the lines from the tile)
-    unsigned short tiledata_addr;
-    if (control.bg_window_tileset) {
-      tiledata_addr = 0x8000 + tilenum*16;
-      assert(tiledata_addr >= 0x8000 || tiledata_addr < 0x9000);
-    } else {
-      tiledata_addr = 0x9000 + (signed char) tilenum*16;
-      assert(tiledata_addr >= 0x8800 || tiledata_addr < 0x9800);
-    }
-    unsigned char tiledata_msb = mem->read_byte(tiledata_addr + 2*(y % 8));
-    unsigned char tiledata_lsb = mem->read_byte(tiledata_addr + 2*(y % 8) + 1);
-    
-    // set the pixels
-    for (unsigned char j = 0; j < 8; j++) {
-      unsigned char mask = (0x80 >> j);
-      unsigned char pal_num = !!(tiledata_msb & mask) + 2*!!(tiledata_lsb & mask);
-      set_pixel(i*8 + j, line, bgp.dot_palette[pal_num]); 
+
+  if (!paced || speed > 1.0) {
+    // faster than real time. draw about as many frames as a display at the
+    // DMG rate can show, judged by when the next frame will be done. the
+    // interval is a little short of a frame so pacing jitter doesn't skip an
+    // extra one
+    std::chrono::duration<double> next_done = now - last_shown;
+    if (paced) {
+      next_done +=
+          std::chrono::duration<double>(1.0 / (refresh_rate_hz * speed));
     }
+    return next_done < std::chrono::duration<double>(0.875 / refresh_rate_hz);
   }
+  // the host can't keep up. save the drawing to catch up, but still show
+  // some frames
+  return pacer.behind() && skip_run < Max_Frame_Skip;
 }
 
-void LCD::draw_background(unsigned char line) {
-  if ( !control.bg_window_enabled) {
-    // clear the screen
-    for (unsigned char i = 0; i < LCD_Width; i++) {
-      set_pixel(i, line, bgp.dot_palette[0]);
+bool LCD::end_frame(void) {
+  // refresh screen. block until the frame is due
+  double speed = turbo ? turbo_speed : Speed_Multi;
+  bool paced = throttle && speed > 0;
+  if (host_frame) {
+    if (paced) {
+      pacer.wait(refresh_rate_hz * speed);
+    } else {
+      pacer.reset();
     }
-    return;
   }
 
-  unsigned short tilemap_base;
-  if (control.bg_tilemap) {
-    tilemap_base = 0x9c00;
-  } else {
-    tilemap_base = 0x9800;
-  }
-  
-  unsigned short y = ((line + scy) % 256);
-  // render line for one tile
-  for (int i = 0; i < LCD_Width/8; i++) {
-    // lookup tilenumber in tilemap
-    unsigned short x = ((i*8 + scx) % 256);
-    unsigned short tilemap_offset = (y / 8) * 32 + x / 8;
-
-    unsigned char tilenum = mem->read_byte(tilemap_base + tilemap_offset);
-
-    // read 2-bytes of pixel data from tiledata table
-    // (only reading 1/8 of the lines from the tile)
-    unsigned short tiledata_addr;
-    if (control.bg_window_tileset) {
-      tiledata_addr = 0x8000 + tilenum*16;
-      assert(tiledata_addr >= 0x8000 || tiledata_addr < 0x9000);
+  if (draw_frames) {
+    if (threaded_render) {
+      // show the last frame while the worker draws this one
+      bool changed = render_thread.finish_frame();
+      if (!render_skipped) {
+        // the worker's frame is done now, a frame after its VBLANK
+        publish_frame(frames - 1);
+        record_frame();
+        present_frame(changed);
+      }
+      render_thread.submit_frame();
+      render_skipped = skip_frame;
     } else {
-      tiledata_addr = 0x9000 + (signed char) tilenum*16;
-      assert(tiledata_addr >= 0x8800 || tiledata_addr < 0x9800);
+      bool changed = renderer.end_frame();
+      if (!skip_frame) {
+        record_frame();
+        present_frame(changed);
+      }
     }
-    unsigned char tiledata_msb = mem->read_byte(tiledata_addr + 2*(y % 8));
-    unsigned char tiledata_lsb = mem->read_byte(tiledata_addr + 2*(y % 8) + 1);
-    
-    // set the pixels
-    for (unsigned char j = 0; j < 8; j++) {
-      unsigned char mask = (0x80 >> j);
-      unsigned char pal_num = !!(tiledata_msb & mask) + 2*!!(tiledata_lsb & mask);
-      set_pixel(i*8 + j, line, bgp.dot_palette[pal_num]); 
+    if (skip_frame) {
+      frames_skipped++;
     }
   }
-}
-
-void LCD::render_scanline(unsigned char line) {
-  draw_background(line);
-  draw_window(line);
-  search_sprites(line);
-  if (control.sprites_enabled && sprites_this_line > 0) {
-    draw_sprites(line);
+  frames++;
+  if (!host_frame) {
+    return false;
   }
 
-// FIXME. debug thing to generate static on screen
-//for (int x = 0; x < LCD_Width; x++) {
-//  set_pixel(x, line, rand() % 4);
-//}
+  // key changes from the frame that just went by are replayed at the same
+  // points of the next one
+  bool quit_input = video->update(input_changes);
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  joypad->schedule_frame(input_changes, cycle(), last_input_poll, now);
+  input_changes.clear();
+  last_input_poll = now;
+
+  skip_frame = frame_skip && should_skip(speed, paced);
+  return quit_input;
 }
 
-bool LCD::step(unsigned int cycles) {
+bool LCD::run_events(void) {
   bool quit_input = false;
-  cycles_this_frame += cycles;
-  if (cycles_this_frame > 70224) {
-    cycles_this_frame = 0;
-  }
-  // "a scanline normally takes 456 clocks"-TCAGBD
-  unsigned int scanline = cycles_this_frame / 456; 
-  unsigned int cycles_this_line = cycles_this_frame % 456;
-
-  // update status register
-  ly = scanline;
-
-  // check for LY==LYC interrupts 
-  if ( scanline == lyc && cycles_this_line == 4) {
-    interrupt->flags |= Interrupt::LCDC_STAT;
-  }
-
-  // cycle timing info comes from TCAGBD 8.*.1 'Timings in DMG'
-  if (scanline < 144) {
-    if (cycles_this_line < 80) {
-      // Mode 2
-      status.mode = SEARCH_OAM;
-      if (status.mode2_enable) {
-        interrupt->flags |= Interrupt::LCDC_STAT;
-      }
-    } else if (cycles_this_line < 448) {
+  while (cycles_this_frame >= next_event) {
+    switch (status.mode) {
+    case SEARCH_OAM:
       // Mode 3
       status.mode = DATA_TRANSFER;
-      if (status.mode != prev_mode && ly < LCD_Height) {
-        render_scanline(ly);
-      }
-    } else { // cycles_this_line < 456
+      update_stat_line();
+      draw_line(ly);
+      next_event += Transfer_Cycles;
+      break;
+    case DATA_TRANSFER:
       // Mode 0
       status.mode = HBLANK;
-      if (status.mode0_enable) {
-        interrupt->flags |= Interrupt::LCDC_STAT;
+      update_stat_line();
+      next_event += Hblank_Cycles;
+      break;
+    case HBLANK:
+      start_line(ly + 1);
+      break;
+    case VBLANK:
+      if (ly == Lines_Per_Frame - 1) {
+        // wrap around to line 0 and show the finished frame
+        cycles_this_frame -= Cycles_Per_Frame;
+        next_event = 0;
+        quit_input |= end_frame();
+        start_line(0);
+      } else {
+        start_line(ly + 1);
       }
-    }
-  } else { // scanline >= 144
-    // Mode 1 - vblank
-    status.mode = VBLANK;
-    if (prev_mode != VBLANK) {
-      interrupt->flags |= Interrupt::VBLANK;
-    }
-    if (status.mode1_enable) {
-      interrupt->flags |= Interrupt::LCDC_STAT;
+      break;
     }
   }
+  return quit_input;
+}
 
-  // refresh screen. block until clock time elapses
-  if (prev_mode == VBLANK && status.mode != VBLANK) {
-    // blocking sleep
-    unsigned int delta_t = SDL_GetTicks() - ms_last_vblank;
-    if (delta_t < (unsigned int)(1000 / refresh_rate_hz / Speed_Multi)) {
-      SDL_Delay((1000/refresh_rate_hz / Speed_Multi) - delta_t);
-    }
-
-    set_sdl_pixels(gb_pixels);
-    sdl_set_frame();
-    quit_input = sdl_update();
-    ms_last_vblank = SDL_GetTicks();
+void LCD::state(Snapshot &s) {
+  // ppu_generation isn't restored. it has to keep counting up so lines drawn
+  // before the restore aren't mistaken for current ones
+  s.io(control);
+  s.io(status);
+  s.io(scy);
+  s.io(scx);
+  s.io(ly);
+  s.io(lyc);
+  s.io(bgp);
+  s.io(obp0);
+  s.io(obp1);
+  s.io(wy);
+  s.io(wx);
+  s.io(cycles_this_frame);
+  s.io(frames);
+  s.io(next_event);
+  s.io(stat_line);
+  if (s.is_loading()) {
+    ppu_generation++;
   }
-  prev_mode = status.mode;
+}
 
-  return quit_input;
+void LCD::refresh_renderer(const unsigned char *old_vram,
+                           const unsigned char *old_oam) {
+  for (unsigned int i = 0; i < 0x2000; i++) {
+    if (mem->vram[i] != old_vram[i]) {
+      vram_written(0x8000 + i, mem->vram[i]);
+    }
+  }
+  for (unsigned int i = 0; i < 0xA0; i++) {
+    if (mem->oram[i] != old_oam[i]) {
+      oam_written(0xFE00 + i, mem->oram[i]);
+    }
+  }
 }
 
 void LCD::init(GB_Sys *gb_sys) {
   mem = gb_sys->mem;
   interrupt = gb_sys->interrupt;
+  video = gb_sys->video;
+  joypad = gb_sys->joypad;
+
+  cycles_this_frame = 0;
+  next_event = 0;
+  start_line(0);
+  last_input_poll = std::chrono::steady_clock::now();
+
+  renderer.init(mem->vram, mem->oram);
+  if (threaded_render) {
+    render_thread.start(&renderer);
+  } else {
+    renderer.output = video;
+  }
 }
@@ -1,4 +1,5 @@
 #include "gb_mbc.h"
+#include "gb_state.h"
 using namespace std;
 
 MBC::MBC(unsigned char *p_ram, unsigned char *p_rom) {
@@ -167,3 +168,10 @@ void MBC5::write_byte(unsigned short address, unsigned char value) {
     cerr << "unimplemented memory range in gb_cart.cpp:mbc3:write_byte" << endl;
   }
 }
+
+void MBC::state(Snapshot &s) {
+  s.io(curr_rom_bank);
+  s.io(curr_ram_bank);
+  s.io(ram_enable);
+  s.io(mbc_mode);
+}
@@ -3,7 +3,10 @@
 #include "gb_int.h"
 #include "gb_timer.h"
 #include "gb_cart.h"
+#include "gb_state.h"
 #include "gb_cpu.h"
+#include "gb_dbg.h"
+#include <algorithm>
 
 bool remapped_cart = false;
 
@@ -37,6 +40,15 @@ void Memory::oam_dma_transfer(unsigned short dst, unsigned short src, size_t len
 }
 
 unsigned char Memory::read_byte(unsigned short address) {
+#ifdef GBCON_DEBUGGER
+  if (traps_enabled && read_traps[address]) {
+    dbg->read_trap(address);
+  }
+#endif
+  return peek_byte(address);
+}
+
+unsigned char Memory::peek_byte(unsigned short address) {
 
   if (address >= 0x000 && address < 0x8000) {
     if (address <= 0x0100 && remapped_cart == false) {
@@ -119,6 +131,7 @@ unsigned char Memory::read_byte(unsigned short address) {
   } else {
     std::cerr << "GBcon: Error: reading from invalid memory address " << hex
          << unsigned(address) << std::endl;
+    cpu->dump_trace(std::cerr);
     cpu->stop = true;
   }
 
@@ -135,6 +148,11 @@ unsigned short Memory::read_short_stack(unsigned short sp) {
 }
 
 void Memory::write_byte(unsigned short address, unsigned char value) {
+#ifdef GBCON_DEBUGGER
+  if (traps_enabled && write_traps[address]) {
+    dbg->write_trap(address, value);
+  }
+#endif
 
   if (address >= 0x000 && address < 0x8000) {
     if (address <= 0x0100 && remapped_cart == false) {
@@ -144,7 +162,11 @@ void Memory::write_byte(unsigned short address, unsigned char value) {
     }
     // cart[address] = value;
   } else if (address >= 0x8000 && address < 0xA000) {
-    vram[address - 0x8000] = value;
+    // the PPU only needs to hear about writes that change something
+    if (vram[address - 0x8000] != value) {
+      vram[address - 0x8000] = value;
+      lcd->vram_written(address, value);
+    }
   } else if (address >= 0xA000 && address < 0xC000) {
     cart->write_byte(address, value);
     // cram[address - 0xA000] = value;
@@ -154,7 +176,10 @@ void Memory::write_byte(unsigned short address, unsigned char value) {
     // TODO echo ram so i should probably do something about mirroring but eh
     eram[address - 0xE000] = value;
   } else if (address >= 0xFE00 && address < 0xFEA0) {
-    oram[address - 0xFE00] = value;
+    if (oram[address - 0xFE00] != value) {
+      oram[address - 0xFE00] = value;
+      lcd->oam_written(address, value);
+    }
   } else if (address >= 0xFEA0 && address < 0xFF00) {
     unused[address - 0xFEA0] = value;
   } else if (address == 0xFF04) {
@@ -196,8 +221,7 @@ void Memory::write_byte(unsigned short address, unsigned char value) {
   } else if (address == 0xFF02) { // SIO control
     // hacky SIO implementation
     if (value == 0x81) {
-      serial_tx_data = ioram[0x4401 - 0x4400];
-      serial_tx_initd = true;
+      serial_data.push_back(ioram[0x4401 - 0x4400]);
     }
   } else if (address >= 0xFF00 && address < 0xFF80) {
     ioram[address - 0xFF00] = value;
@@ -208,6 +232,7 @@ void Memory::write_byte(unsigned short address, unsigned char value) {
   } else {
     std::cerr << "GBcon: Error: writing to invalid memory address " << hex
          << unsigned(address) << std::endl;
+    cpu->dump_trace(std::cerr);
     cpu->stop = true;
   }
 }
@@ -232,7 +257,7 @@ void Memory::print_memory_range(unsigned short start_addr,
     std::cout << hex << setfill('0') << setw(4) << unsigned(i << 4) << " | ";
     for (unsigned short j = 0; j <= 0xF; j++) {
       addr = (i << 4) + j;
-      std::cout << hex << setfill('0') << setw(2) << unsigned(read_byte(addr))
+      std::cout << hex << setfill('0') << setw(2) << unsigned(peek_byte(addr))
            << " ";
     }
     std::cout << std::endl;
@@ -247,17 +272,42 @@ void Memory::print_to_file(std::string filepath) {
     ofs << hex << setfill('0') << setw(4) << unsigned(i << 4) << " | ";
     for (unsigned short j = 0; j <= 0xF; j++) {
       addr = (i << 4) + j;
-      ofs << hex << setfill('0') << setw(2) << unsigned(read_byte(addr)) << " ";
+      ofs << hex << setfill('0') << setw(2) << unsigned(peek_byte(addr)) << " ";
     }
     ofs << std::endl;
   }
   ofs.close();
 }
 
+void Memory::write_serial_log_file(std::string filepath) {
+  std::ofstream out(filepath, std::ofstream::out | std::ofstream::trunc);
+  for (const auto &c : serial_data ) out << char(c); 
+  out << "\0";
+}
+
 void Memory::init(GB_Sys *gb_sys) {
   cpu = gb_sys->cpu;
   lcd = gb_sys->lcd;
   interrupt = gb_sys->interrupt;
   cart = gb_sys->cart;
   timer = gb_sys->timer;
+  dbg = gb_sys->dbg;
+}
+
+void Memory::state(Snapshot &s) {
+  s.io(vram);
+  s.io(sram);
+  s.io(eram);
+  s.io(oram);
+  s.io(unused);
+  s.io(ioram);
+  s.io(hram);
+  s.io(remapped_cart);
+  // serial output only grows. keep its length
+  size_t serial_len = serial_data.size();
+  s.io(serial_len);
+  // a state from another run can't bring back bytes this one never sent
+  if (s.is_loading()) {
+    serial_data.resize(std::min(serial_len, serial_data.size()));
+  }
 }
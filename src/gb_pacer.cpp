@@ -0,0 +1,73 @@
+#include "gb_pacer.h"
+#include <cerrno>
+#include <cmath>
+#include <iomanip>
+#include <time.h>
+
+void FramePacer::wait(double hz) {
+  clock::time_point now = clock::now();
+
+  late = false;
+  if (hz != rate_hz) {
+    // new rate (or first frame). start the schedule from here
+    rate_hz = hz;
+    period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(1.0 / hz));
+    deadline = now;
+    last_frame = now;
+    return;
+  }
+
+  deadline += period;
+  if (now - deadline > period * Max_Frames_Behind) {
+    // too far behind to catch up. don't rush out a burst of frames
+    deadline = now;
+    last_frame = now;
+    resyncs++;
+    return;
+  }
+  late = now > deadline;
+
+  if (deadline - now > Spin_Margin) {
+    // steady_clock is CLOCK_MONOTONIC, so its epoch can be used directly
+    auto wake = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        (deadline - Spin_Margin).time_since_epoch());
+    struct timespec ts;
+    ts.tv_sec = wake.count() / 1000000000;
+    ts.tv_nsec = wake.count() % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+           EINTR) {
+      // interrupted by a signal. go back to sleep
+    }
+  }
+  do {
+    now = clock::now();
+  } while (now < deadline);
+
+  double interval = std::chrono::duration<double>(now - last_frame).count();
+  double error = std::fabs(interval - 1.0 / rate_hz);
+  intervals++;
+  interval_sum += interval;
+  interval_sum_sq += interval * interval;
+  if (error > max_error) {
+    max_error = error;
+  }
+  last_frame = now;
+}
+
+void FramePacer::print_stats(std::ostream &os) {
+  if (intervals == 0) {
+    os << "GBcon: frame pacing: no paced frames" << std::endl;
+    return;
+  }
+  double mean = interval_sum / intervals;
+  double var = interval_sum_sq / intervals - mean * mean;
+  double jitter = var > 0 ? std::sqrt(var) : 0;
+  os << std::dec << std::fixed << std::setprecision(3)
+     << "GBcon: frame pacing over " << intervals << " frames\n"
+     << "  target " << 1000.0 / rate_hz << " ms, mean " << mean * 1000
+     << " ms\n"
+     << "  jitter " << jitter * 1000 << " ms (stddev), worst "
+     << max_error * 1000 << " ms off\n"
+     << "  " << resyncs << " schedule resets" << std::endl;
+}
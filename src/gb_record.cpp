@@ -0,0 +1,318 @@
+#include "gb_record.h"
+#include "gb_lcd.h"
+#include "gb_sdl.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+// std::min binds it to a reference
+const unsigned int Recorder::Max_Png_Writers;
+
+/* Output helpers
+ */
+
+static bool ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// full range (JPEG) BT.601 of a Palette entry
+struct Yuv {
+  unsigned char y, u, v;
+};
+static Yuv palette_yuv(unsigned int shade) {
+  double r = (Palette[shade] >> 16) & 0xFF;
+  double g = (Palette[shade] >> 8) & 0xFF;
+  double b = Palette[shade] & 0xFF;
+  auto clamp = [](double x) {
+    return (unsigned char)std::min(std::max(x + 0.5, 0.0), 255.0);
+  };
+  return Yuv{clamp(0.299 * r + 0.587 * g + 0.114 * b),
+             clamp(128 - 0.168736 * r - 0.331264 * g + 0.5 * b),
+             clamp(128 + 0.5 * r - 0.418688 * g - 0.081312 * b)};
+}
+
+static unsigned int png_crc(const unsigned char *data, size_t len,
+                            unsigned int crc = 0xFFFFFFFF) {
+  static const std::vector<unsigned int> table = [] {
+    std::vector<unsigned int> t(256);
+    for (unsigned int n = 0; n < 256; n++) {
+      unsigned int c = n;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      }
+      t[n] = c;
+    }
+    return t;
+  }();
+  for (size_t i = 0; i < len; i++) {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+static void put_be32(std::vector<unsigned char> &out, unsigned int v) {
+  out.push_back(v >> 24);
+  out.push_back(v >> 16);
+  out.push_back(v >> 8);
+  out.push_back(v);
+}
+
+static void png_chunk(std::vector<unsigned char> &out, const char *type,
+                      const std::vector<unsigned char> &data) {
+  put_be32(out, data.size());
+  size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  put_be32(out, png_crc(&out[start], out.size() - start) ^ 0xFFFFFFFF);
+}
+
+/* Recorder
+ */
+
+Recorder::~Recorder() { close(); }
+
+bool Recorder::open(const std::string &target) {
+  this->target = target;
+  num_writers = 1;
+  if (!target.empty() && target[0] == '|') {
+    // a command that goes away makes writes fail instead of killing us
+    signal(SIGPIPE, SIG_IGN);
+    out = popen(target.c_str() + 1, "w");
+    piped = true;
+  } else if (ends_with(target, ".y4m")) {
+    out = fopen(target.c_str(), "wb");
+  } else if (ends_with(target, ".png")) {
+    format = PNG;
+    num_writers = std::min(std::max(std::thread::hardware_concurrency() / 2,
+                                    1u),
+                           Max_Png_Writers);
+  } else {
+    std::cerr << "GBcon: --record needs a .y4m or .png file, or |command"
+              << std::endl;
+    return false;
+  }
+
+  if (format == Y4M) {
+    if (out == nullptr) {
+      std::cerr << "GBcon: can't open " << target << " to record"
+                << std::endl;
+      return false;
+    }
+    // exact DMG frame rate as a reduced fraction
+    unsigned long num = 4194304, den = LCD::Cycles_Per_Frame;
+    unsigned long a = num, b = den;
+    while (b != 0) {
+      unsigned long r = a % b;
+      a = b;
+      b = r;
+    }
+    num /= a;
+    den /= a;
+    fprintf(out, "YUV4MPEG2 W%u H%u F%lu:%lu Ip A1:1 C420jpeg\n", LCD_Width,
+            LCD_Height, num, den);
+    // frames dropped before the first one is written repeat a blank screen
+    Yuv blank = palette_yuv(0);
+    memset(yuv, blank.y, LCD_Width * LCD_Height);
+    memset(yuv + LCD_Width * LCD_Height, blank.u, LCD_Width * LCD_Height / 4);
+    memset(yuv + LCD_Width * LCD_Height * 5 / 4, blank.v,
+           LCD_Width * LCD_Height / 4);
+  }
+
+  done = false;
+  failed = false;
+  for (unsigned int i = 0; i < num_writers; i++) {
+    writers[i].thread = std::thread(&Recorder::writer_loop, this, &writers[i]);
+  }
+  return true;
+}
+
+void Recorder::push(const unsigned char *shades) {
+  unsigned long number = frames_recorded + frames_dropped;
+  if (!failed.load(std::memory_order_relaxed)) {
+    // the next writer in turn, or any other that has room
+    for (unsigned int i = 0; i < num_writers; i++) {
+      Writer *w = &writers[(next_writer + i) % num_writers];
+      Frame *f = w->queue.claim();
+      if (f != nullptr) {
+        f->number = number;
+        memcpy(f->shades, shades, sizeof(f->shades));
+        w->queue.commit();
+        w->cv.notify_one();
+        next_writer = (next_writer + i + 1) % num_writers;
+        frames_recorded++;
+        return;
+      }
+    }
+    if (frames_dropped == 0) {
+      std::cerr << "GBcon: recording can't keep up, dropping frames"
+                << std::endl;
+    }
+  }
+  frames_dropped++;
+}
+
+void Recorder::close(void) {
+  if (num_writers == 0) {
+    return;
+  }
+  done = true;
+  for (unsigned int i = 0; i < num_writers; i++) {
+    writers[i].cv.notify_one();
+    writers[i].thread.join();
+  }
+  num_writers = 0;
+
+  if (out != nullptr) {
+    if (piped) {
+      int status = pclose(out);
+      if (status != 0) {
+        std::cerr << "GBcon: record command exited with status " << status
+                  << std::endl;
+      }
+    } else {
+      fclose(out);
+    }
+    out = nullptr;
+  }
+
+  std::cout << std::dec << "GBcon: recorded " << frames_recorded
+            << " frames to " << target;
+  if (frames_dropped) {
+    std::cout << ", dropped " << frames_dropped;
+  }
+  std::cout << std::endl;
+}
+
+void Recorder::fail(const char *what) {
+  if (!failed.exchange(true)) {
+    std::cerr << "GBcon: recording to " << target << " stopped: " << what
+              << std::endl;
+  }
+}
+
+void Recorder::writer_loop(Writer *w) {
+  while (true) {
+    // done is set after the last push, so once it's seen an empty queue
+    // stays empty
+    bool finishing = done.load(std::memory_order_acquire);
+    const Frame *f = w->queue.peek();
+    if (f == nullptr) {
+      if (finishing) {
+        break;
+      }
+      // the emulation thread doesn't take the lock to wake us, so a wakeup
+      // can be missed. the timeout bounds how late that frame gets written
+      std::unique_lock<std::mutex> l(w->lock);
+      w->cv.wait_for(l, std::chrono::milliseconds(1), [this, w] {
+        return w->queue.peek() != nullptr || done.load();
+      });
+      continue;
+    }
+    if (!failed.load(std::memory_order_relaxed)) {
+      bool ok = (format == Y4M) ? write_y4m(*f) : write_png(*f);
+      if (!ok) {
+        fail(strerror(errno));
+      }
+    }
+    w->queue.release();
+  }
+}
+
+bool Recorder::write_y4m(const Frame &f) {
+  // a dropped frame is shown as the one before it
+  for (; next_number < f.number; next_number++) {
+    if (fputs("FRAME\n", out) == EOF ||
+        fwrite(yuv, sizeof(yuv), 1, out) != 1) {
+      return false;
+    }
+  }
+  next_number++;
+
+  Yuv colors[4];
+  for (unsigned int i = 0; i < 4; i++) {
+    colors[i] = palette_yuv(i);
+  }
+  unsigned char *y_plane = yuv;
+  unsigned char *u_plane = yuv + LCD_Width * LCD_Height;
+  unsigned char *v_plane = u_plane + LCD_Width * LCD_Height / 4;
+  for (unsigned int i = 0; i < LCD_Width * LCD_Height; i++) {
+    y_plane[i] = colors[f.shades[i] & 3].y;
+  }
+  // 4:2:0, chroma averaged over each 2x2 block
+  for (unsigned int y = 0; y < LCD_Height; y += 2) {
+    for (unsigned int x = 0; x < LCD_Width; x += 2) {
+      const unsigned char *p = &f.shades[y * LCD_Width + x];
+      const Yuv *block[4] = {&colors[p[0] & 3], &colors[p[1] & 3],
+                             &colors[p[LCD_Width] & 3],
+                             &colors[p[LCD_Width + 1] & 3]};
+      unsigned int u = 2, v = 2;
+      for (const Yuv *c : block) {
+        u += c->u;
+        v += c->v;
+      }
+      unsigned int i = (y / 2) * (LCD_Width / 2) + x / 2;
+      u_plane[i] = u / 4;
+      v_plane[i] = v / 4;
+    }
+  }
+  return fputs("FRAME\n", out) != EOF &&
+         fwrite(yuv, sizeof(yuv), 1, out) == 1;
+}
+
+bool Recorder::write_png(const Frame &f) {
+  // 2 bit indexed color, one shade per palette entry
+  std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A,
+                                    '\n'};
+  std::vector<unsigned char> data;
+  put_be32(data, LCD_Width);
+  put_be32(data, LCD_Height);
+  data.insert(data.end(), {2, 3, 0, 0, 0});
+  png_chunk(png, "IHDR", data);
+
+  data.clear();
+  for (unsigned int i = 0; i < 4; i++) {
+    data.push_back(Palette[i] >> 16);
+    data.push_back(Palette[i] >> 8);
+    data.push_back(Palette[i]);
+  }
+  png_chunk(png, "PLTE", data);
+
+  // rows of filter type 0 then 4 pixels a byte, in one stored (uncompressed)
+  // deflate block. a frame is about 6KB, so compressing isn't worth a
+  // dependency
+  std::vector<unsigned char> rows;
+  for (unsigned int y = 0; y < LCD_Height; y++) {
+    rows.push_back(0);
+    const unsigned char *line = &f.shades[y * LCD_Width];
+    for (unsigned int x = 0; x < LCD_Width; x += 4) {
+      rows.push_back((line[x] & 3) << 6 | (line[x + 1] & 3) << 4 |
+                     (line[x + 2] & 3) << 2 | (line[x + 3] & 3));
+    }
+  }
+  unsigned int a = 1, b = 0;
+  for (unsigned char c : rows) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  data = {0x78, 0x01, 0x01, (unsigned char)rows.size(),
+          (unsigned char)(rows.size() >> 8), (unsigned char)~rows.size(),
+          (unsigned char)(~rows.size() >> 8)};
+  data.insert(data.end(), rows.begin(), rows.end());
+  put_be32(data, b << 16 | a);
+  png_chunk(png, "IDAT", data);
+  png_chunk(png, "IEND", {});
+
+  char number[16];
+  snprintf(number, sizeof(number), "%06lu", f.number);
+  std::string path = target.substr(0, target.size() - 4) + number + ".png";
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(png.data(), png.size(), 1, file) == 1;
+  return fclose(file) == 0 && ok;
+}
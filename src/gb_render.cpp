@@ -0,0 +1,380 @@
+#include "gb_render.h"
+#include "gb_sdl.h"
+#include "gb_simd.h"
+#include "gb_video.h"
+#include <algorithm>
+#include <cstring>
+
+/* Renderer
+ */
+
+void Renderer::init(const unsigned char *vram_src, const unsigned char *oam_src) {
+  memcpy(vram, vram_src, sizeof(vram));
+  memcpy(oam, oam_src, sizeof(oam));
+
+  // sync the tile cache, map bitmaps and sprite table
+  gb_simd::kernels->decode_tile_rows(vram, &tile_cache[0][0][0],
+                                     Num_Tiles * 8);
+  map_entry_dirty[0].set();
+  map_entry_dirty[1].set();
+  map_bitmaps_dirty = true;
+  sprite_table_dirty = true;
+  // not a shade, so the first frame always counts as changed
+  memset(gb_pixels, 0xFF, sizeof(gb_pixels));
+}
+
+void Renderer::write_vram(unsigned short offset, unsigned char value) {
+  vram[offset] = value;
+  if (offset < 0x1800) {
+    // re-decode the tile row. each is 2 bytes, bit 7 is the leftmost pixel
+    offset &= ~1;
+    gb_simd::kernels->decode_tile_rows(&vram[offset],
+                                       tile_cache[offset / 16][(offset / 2) % 8],
+                                       1);
+    tile_dirty[offset / 16] = true;
+  } else {
+    offset -= 0x1800;
+    map_entry_dirty[offset / 1024][offset % 1024] = true;
+  }
+  map_bitmaps_dirty = true;
+}
+
+void Renderer::write_oam(unsigned char offset, unsigned char value) {
+  oam[offset] = value;
+  sprite_table_dirty = true;
+}
+
+static void decode_palette(unsigned char value, unsigned char dots[4]) {
+  for (int i = 0; i < 4; i++) {
+    dots[i] = (value >> (2 * i)) & 0x03;
+  }
+}
+
+void Renderer::set_regs(const Regs &line_regs) {
+  unsigned char changed = regs.lcdc ^ line_regs.lcdc;
+  if (changed) {
+    // switching tilesets changes every tile in both maps
+    if (changed & 0x10) {
+      map_entry_dirty[0].set();
+      map_entry_dirty[1].set();
+      map_bitmaps_dirty = true;
+    }
+    // 8x16 sprites cover more lines
+    if (changed & 0x04) {
+      sprite_table_dirty = true;
+    }
+    unsigned char lcdc = line_regs.lcdc;
+    render_line = Line_Renderers[(lcdc & 0x07) | ((lcdc >> 2) & 0x08)];
+    bg_map = map_bitmaps[!!(lcdc & 0x08)];
+    window_map = map_bitmaps[!!(lcdc & 0x40)];
+  }
+  decode_palette(line_regs.bgp, bgp_dots);
+  decode_palette(line_regs.obp0, obp_dots[0]);
+  decode_palette(line_regs.obp1, obp_dots[1]);
+  regs = line_regs;
+}
+
+inline unsigned int Renderer::bg_tile_index(unsigned char tilenum) {
+  if ((regs.lcdc & 0x10)) {
+    return tilenum;
+  } else {
+    return 256 + (signed char) tilenum;
+  }
+}
+
+void Renderer::update_map_bitmaps(void) {
+  for (int map = 0; map < 2; map++) {
+    const unsigned char *tilemap = &vram[0x1800 + map * 1024];
+    for (int i = 0; i < 1024; i++) {
+      unsigned int tile = bg_tile_index(tilemap[i]);
+      if (!map_entry_dirty[map][i] && !tile_dirty[tile]) {
+        continue;
+      }
+      for (int row = 0; row < 8; row++) {
+        memcpy(&map_bitmaps[map][(i / 32) * 8 + row][(i % 32) * 8],
+               tile_cache[tile][row], 8);
+      }
+    }
+    map_entry_dirty[map].reset();
+  }
+  tile_dirty.reset();
+  map_bitmaps_dirty = false;
+}
+
+void Renderer::rebuild_sprite_table(void) {
+  // read sprites from OAM
+  for (int i = 0; i < Num_Sprites; i++) {
+    sprites[i].y_pos    = oam[i*4 + 0] - 16;
+    sprites[i].x_pos    = oam[i*4 + 1] - 8;
+    sprites[i].tile_num = oam[i*4 + 2];
+    sprites[i].attr     = oam[i*4 + 3];
+  }
+
+  // the PPU takes the first 10 sprites in OAM order that cover a line,
+  // whatever their x position
+  int height = 8 + 8 * !!(regs.lcdc & 0x04);
+  memset(line_sprite_count, 0, sizeof(line_sprite_count));
+  for (int i = 0; i < Num_Sprites; i++) {
+    int first = std::max(sprites[i].y_pos, 0);
+    int last = std::min(sprites[i].y_pos + height, (int)LCD_Height);
+    for (int line = first; line < last; line++) {
+      if (line_sprite_count[line] < Num_Sprites_Per_Line) {
+        line_sprites[line][line_sprite_count[line]++] = i;
+      }
+    }
+  }
+
+  // DMG priority: smaller x wins, then lower OAM index. draw the losers first
+  auto draws_before = [this](unsigned char a, unsigned char b) {
+    if (sprites[a].x_pos != sprites[b].x_pos) {
+      return sprites[a].x_pos > sprites[b].x_pos;
+    }
+    return a > b;
+  };
+  for (int line = 0; line < LCD_Height; line++) {
+    std::sort(&line_sprites[line][0],
+              &line_sprites[line][line_sprite_count[line]], draws_before);
+  }
+
+  sprite_table_dirty = false;
+}
+
+template <bool Tall_Sprites> void Renderer::draw_sprites(unsigned char line) {
+
+  for (int i = 0; i < line_sprite_count[line]; i++) {
+    Sprite *sp = &sprites[line_sprites[line][i]];
+
+    unsigned short sprite_row;
+    if (sp->attr & Sprite_Attr_Masks.Y_Flip) {
+      unsigned char size = 8 + 8 * Tall_Sprites - 1;
+      sprite_row = size - (line - sp->y_pos);
+    } else {
+      sprite_row = line - sp->y_pos;
+    }
+
+    const unsigned char *dot_palette =
+        obp_dots[!!(sp->attr & Sprite_Attr_Masks.Palette)];
+
+    // 1 line of decoded pixel data. 8x16 sprites continue into the next tile
+    const unsigned char *tile_row =
+        tile_cache[sp->tile_num + sprite_row / 8][sprite_row % 8];
+
+    // set the pixels
+    for (unsigned char j = 0; j < 8; j++) {
+      // account for x flip
+      unsigned char j_flip = sp->attr & Sprite_Attr_Masks.X_Flip ? (7 - j) : j;
+
+      // check if pixel x pos is on screen
+      if ( sp->x_pos + j >= LCD_Width || sp->x_pos + j_flip < 0) {
+        continue;
+      }
+
+      // get pixel's palette number 
+      unsigned char pal_num = tile_row[j_flip];
+      // sprite color number 0 is always transparent
+      if (pal_num == dot_palette[0]) {
+        continue;
+      }
+
+      // check OBJ-to-BG flag (only render over BG color 0)
+      if (sp->attr & Sprite_Attr_Masks.Priority) {
+        unsigned pixel_col = line_shades[sp->x_pos + j];
+        if ( pixel_col != bgp_dots[0]) {
+          continue;
+        }
+      }
+
+      // set pixel
+      unsigned char color = dot_palette[pal_num];
+      line_shades[sp->x_pos + j] = color; // note: not j_flip
+    }
+  }
+}
+
+void Renderer::draw_window(unsigned char line) {
+  // line with window offset outside LCD display?
+  if (!(line > regs.wy && line - regs.wy < LCD_Height)) {
+    return;
+  }
+
+  memcpy(line_colors, window_map[line - regs.wy], LCD_Width);
+}
+
+void Renderer::draw_background(unsigned char line) {
+  const unsigned char *row = bg_map[(line + regs.scy) % 256];
+  // the map wraps around horizontally
+  unsigned int first = 256 - regs.scx;
+  if (first >= LCD_Width) {
+    memcpy(line_colors, &row[regs.scx], LCD_Width);
+  } else {
+    memcpy(line_colors, &row[regs.scx], first);
+    memcpy(&line_colors[first], row, LCD_Width - first);
+  }
+}
+
+template <bool Bg, bool Window, bool Sprites, bool Tall_Sprites>
+void Renderer::render_scanline(unsigned char line) {
+  if (map_bitmaps_dirty) {
+    update_map_bitmaps();
+  }
+  if (Bg) {
+    draw_background(line);
+  } else {
+    // clear the screen
+    memset(line_colors, 0, sizeof(line_colors));
+  }
+  if (Window) {
+    draw_window(line);
+  }
+  // bg/window color numbers -> shades
+  gb_simd::kernels->map_palette(line_colors, line_shades, LCD_Width, regs.bgp);
+  if (Sprites) {
+    if (sprite_table_dirty) {
+      rebuild_sprite_table();
+    }
+    if (line_sprite_count[line] > 0) {
+      draw_sprites<Tall_Sprites>(line);
+    }
+  }
+}
+
+// <Bg, Window, Sprites, Tall_Sprites>
+const Renderer::Line_Renderer Renderer::Line_Renderers[16] = {
+    &Renderer::render_scanline<false, false, false, false>,
+    &Renderer::render_scanline<true, false, false, false>,
+    &Renderer::render_scanline<false, false, true, false>,
+    &Renderer::render_scanline<true, false, true, false>,
+    &Renderer::render_scanline<false, false, false, true>,
+    &Renderer::render_scanline<true, false, false, true>,
+    &Renderer::render_scanline<false, false, true, true>,
+    &Renderer::render_scanline<true, false, true, true>,
+    &Renderer::render_scanline<false, true, false, false>,
+    &Renderer::render_scanline<true, true, false, false>,
+    &Renderer::render_scanline<false, true, true, false>,
+    &Renderer::render_scanline<true, true, true, false>,
+    &Renderer::render_scanline<false, true, false, true>,
+    &Renderer::render_scanline<true, true, false, true>,
+    &Renderer::render_scanline<false, true, true, true>,
+    &Renderer::render_scanline<true, true, true, true>};
+
+inline void Renderer::expand_line(unsigned char line) {
+  // shades -> ARGB, straight into the frame
+  gb_simd::kernels->expand_argb(&gb_pixels[line * LCD_Width],
+                                &frame_pixels[line * frame_pitch], LCD_Width,
+                                Palette);
+}
+
+void Renderer::draw_line(unsigned char line, const Regs &line_regs,
+                         unsigned long generation) {
+  unsigned char *shades = &gb_pixels[line * LCD_Width];
+  if (line_generation[line] != generation) {
+    line_generation[line] = generation;
+    set_regs(line_regs);
+    (this->*render_line)(line);
+    if (memcmp(line_shades, shades, LCD_Width) != 0) {
+      memcpy(shades, line_shades, LCD_Width);
+      if (frame_pixels == nullptr) {
+        // first change this frame. the lines above it still need filling in
+        if (output) {
+          frame_pixels = output->lock_frame(&frame_pitch);
+        } else {
+          frame_pixels = argb;
+          frame_pitch = LCD_Width;
+        }
+        for (unsigned char y = 0; y < line; y++) {
+          expand_line(y);
+        }
+      }
+    }
+  }
+  if (frame_pixels != nullptr) {
+    expand_line(line);
+  }
+}
+
+bool Renderer::end_frame(void) {
+  bool changed = frame_pixels != nullptr;
+  frame_pixels = nullptr;
+  return changed;
+}
+
+/* RenderThread
+ */
+
+RenderThread::~RenderThread() { close(); }
+
+void RenderThread::start(Renderer *r) {
+  renderer = r;
+  renderer->output = nullptr;
+  log = &logs[0];
+  log->clear();
+  done = false;
+  worker = std::thread(&RenderThread::worker_loop, this);
+}
+
+bool RenderThread::finish_frame(void) {
+  std::unique_lock<std::mutex> lk(lock);
+  cv.wait(lk, [this] { return pending == nullptr; });
+  bool changed = frame_changed;
+  frame_changed = false;
+  return changed;
+}
+
+void RenderThread::submit_frame(void) {
+  log->push_back(Render_Cmd{Render_Cmd::FRAME, 0, 0, 0, {}, 0});
+  {
+    std::lock_guard<std::mutex> lk(lock);
+    pending = log;
+  }
+  cv.notify_all();
+
+  // the worker is done with the other log (finish_frame waited for it)
+  log = (log == &logs[0]) ? &logs[1] : &logs[0];
+  log->clear();
+}
+
+void RenderThread::worker_loop(void) {
+  std::unique_lock<std::mutex> lk(lock);
+  while (true) {
+    cv.wait(lk, [this] { return pending != nullptr || done; });
+    if (pending != nullptr) {
+      const std::vector<Render_Cmd> *frame = pending;
+      lk.unlock();
+      bool changed = false;
+      for (const Render_Cmd &c : *frame) {
+        switch (c.type) {
+        case Render_Cmd::VRAM:
+          renderer->write_vram(c.offset, c.value);
+          break;
+        case Render_Cmd::OAM:
+          renderer->write_oam(c.offset, c.value);
+          break;
+        case Render_Cmd::LINE:
+          renderer->draw_line(c.line, c.regs, c.generation);
+          break;
+        case Render_Cmd::FRAME:
+          changed = renderer->end_frame();
+          break;
+        }
+      }
+      lk.lock();
+      frame_changed = changed;
+      pending = nullptr;
+      cv.notify_all();
+    } else if (done) {
+      return;
+    }
+  }
+}
+
+void RenderThread::close(void) {
+  if (!worker.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lk(lock);
+    done = true;
+  }
+  cv.notify_all();
+  worker.join();
+}
@@ -0,0 +1,156 @@
+#include "gb_scale.h"
+#include "gb_simd.h"
+#include <algorithm>
+#include <cstring>
+
+// std::min binds it to a reference
+const unsigned int Scaler::Max_Bands;
+
+static const char *Filter_Names[] = {"auto", "sdl", "nearest", "scale2x",
+                                     "scale3x"};
+
+bool Scaler::parse_filter(const std::string &name, Filter *filter) {
+  for (unsigned int i = 0; i < sizeof(Filter_Names) / sizeof(*Filter_Names);
+       i++) {
+    if (name == Filter_Names[i]) {
+      *filter = (Filter)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int Scaler::filter_factor(Filter filter) {
+  switch (filter) {
+  case SCALE2X:
+    return 2;
+  case SCALE3X:
+    return 3;
+  default:
+    return 1;
+  }
+}
+
+Scaler::~Scaler() { close(); }
+
+void Scaler::init(Filter filter, unsigned int factor) {
+  close();
+  this->filter = (filter == AUTO || filter == SDL) ? NEAREST : filter;
+  this->factor = factor;
+  repeat = factor / filter_factor(this->filter);
+
+  // below 3x a frame scales in less time than it takes to wake a thread
+  unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+  num_bands = factor >= 3 ? std::min(cores, Max_Bands) : 1;
+  done = false;
+  job = 0;
+  for (unsigned int band = 1; band < num_bands; band++) {
+    helpers.emplace_back(&Scaler::helper_loop, this, band);
+  }
+}
+
+void Scaler::close(void) {
+  {
+    std::lock_guard<std::mutex> l(lock);
+    done = true;
+  }
+  start_cv.notify_all();
+  for (std::thread &t : helpers) {
+    t.join();
+  }
+  helpers.clear();
+  num_bands = 1;
+}
+
+void Scaler::scale(const unsigned int *in, unsigned int *out, int pitch) {
+  this->in = in;
+  this->out = out;
+  this->pitch = pitch;
+  if (num_bands == 1) {
+    scale_band(0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> l(lock);
+    busy = num_bands - 1;
+    job++;
+  }
+  start_cv.notify_all();
+  scale_band(0);
+  std::unique_lock<std::mutex> l(lock);
+  done_cv.wait(l, [this] { return busy == 0; });
+}
+
+void Scaler::helper_loop(unsigned int band) {
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> l(lock);
+  while (true) {
+    start_cv.wait(l, [this, seen] { return job != seen || done; });
+    if (done) {
+      return;
+    }
+    seen = job;
+    l.unlock();
+    scale_band(band);
+    l.lock();
+    if (--busy == 0) {
+      done_cv.notify_one();
+    }
+  }
+}
+
+void Scaler::scale_band(unsigned int band) {
+  const gb_simd::Kernels *k = gb_simd::kernels;
+  unsigned int first = band * LCD_Height / num_bands;
+  unsigned int last = (band + 1) * LCD_Height / num_bands;
+  unsigned int filtered_rows = filter_factor(filter);
+  size_t row_bytes = LCD_Width * factor * sizeof(unsigned int);
+
+  // rows around the one being filtered, edge pixels repeated one past each
+  // side as the kernels expect
+  unsigned int padded[3][LCD_Width + 2];
+  // filtered rows, when they still have to be repeated
+  unsigned int filtered[3][LCD_Width * 3];
+
+  for (unsigned int y = first; y < last; y++) {
+    unsigned int *dst = out + y * factor * pitch;
+    if (filter == NEAREST) {
+      k->scale_row(in + y * LCD_Width, dst, LCD_Width, repeat);
+    } else {
+      for (unsigned int r = 0; r < 3; r++) {
+        int src = std::min(std::max((int)y - 1 + (int)r, 0),
+                           (int)LCD_Height - 1);
+        memcpy(&padded[r][1], in + src * LCD_Width,
+               LCD_Width * sizeof(unsigned int));
+        padded[r][0] = padded[r][1];
+        padded[r][LCD_Width + 1] = padded[r][LCD_Width];
+      }
+      unsigned int *rows[3];
+      for (unsigned int r = 0; r < filtered_rows; r++) {
+        rows[r] = (repeat == 1) ? dst + r * pitch : filtered[r];
+      }
+      if (filter == SCALE2X) {
+        k->scale2x_row(&padded[0][1], &padded[1][1], &padded[2][1], rows,
+                       LCD_Width);
+      } else {
+        k->scale3x_row(&padded[0][1], &padded[1][1], &padded[2][1], rows,
+                       LCD_Width);
+      }
+      if (repeat > 1) {
+        for (unsigned int r = 0; r < filtered_rows; r++) {
+          k->scale_row(filtered[r], dst + r * repeat * pitch,
+                       LCD_Width * filtered_rows, repeat);
+        }
+      }
+    }
+
+    // each filtered row makes repeat output rows
+    for (unsigned int r = 0; r < filtered_rows; r++) {
+      unsigned int *row = dst + r * repeat * pitch;
+      for (unsigned int i = 1; i < repeat; i++) {
+        memcpy(row + i * pitch, row, row_bytes);
+      }
+    }
+  }
+}
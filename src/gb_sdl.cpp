@@ -1,18 +1,45 @@
 #include "gb_sdl.h"
 #include "gb_cpu.h"
+#include "gb_present.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+#include <vector>
 
 struct timeval t1, t2;
 struct display display;
-struct sdl_joypad joypad;
+static struct sdl_joypad joypad;
+// last key state handed to the core
+static Input_Change reported;
 Sdl_emu_keys emu_keys;
 unsigned int frames;
 
 using namespace std;
 
-unsigned char buttons;
-unsigned char direction;
+/* presentation thread. with Sdl_params::present_thread the window, renderer
+   and event loop all live on their own thread, so a slow SDL_RenderPresent
+   never holds up emulation. finished frames go to it through a triple
+   buffer and SDL events come back through a queue, which sdl_update drains
+   on the emulation thread
+ */
+struct presenter {
+  bool enabled;
+  std::thread thread;
+  std::atomic<bool> done;
+  TripleBuffer<Uint32, LCD_Width * LCD_Height> frames;
+  SpscQueue<SDL_Event, 256> events;
+  // only for the presenter to sleep on while there's nothing to show
+  std::mutex lock;
+  std::condition_variable cv;
+} presenter;
 
-void sdl_init(Sdl_params p) {
+// scales frames on the CPU when set, into a texture the size of the window
+static bool cpu_scaling;
+static Scaler scaler;
+
+static void init_video(Sdl_params p) {
   /* video init */
   SDL_SetMainReady();
   SDL_Init(SDL_INIT_VIDEO);
@@ -33,28 +60,115 @@ void sdl_init(Sdl_params p) {
     return;
   }
 
-  if (p.scale > 1) {
+  Scaler::Filter filter = p.filter;
+  if (filter == Scaler::AUTO) {
+    // software renderers scale slowly. do it on the CPU for them
+    SDL_RendererInfo info;
+    bool software = SDL_GetRendererInfo(display.renderer, &info) == 0 &&
+                    (info.flags & SDL_RENDERER_SOFTWARE);
+    filter = software ? Scaler::NEAREST : Scaler::SDL;
+  }
+  cpu_scaling = p.scale > 1 && filter != Scaler::SDL;
+  if (cpu_scaling) {
+    scaler.init(filter, p.scale);
+  } else if (p.scale > 1) {
     if (SDL_RenderSetLogicalSize(display.renderer, LCD_Width, LCD_Height) < 0) {
       cerr << "failed to set SDL renderer size" << endl;
     }
   }
 
   // init frameBuffer
-  display.frameBuffer =
-      SDL_CreateTexture(display.renderer, SDL_PIXELFORMAT_ARGB8888,
-                        SDL_TEXTUREACCESS_STREAMING, LCD_Width, LCD_Height);
+  int texture_scale = cpu_scaling ? p.scale : 1;
+  display.frameBuffer = SDL_CreateTexture(
+      display.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+      texture_scale * LCD_Width, texture_scale * LCD_Height);
   if (display.frameBuffer == nullptr) {
     cerr << "failed to create sdl texture" << endl;
     return;
   }
 
   frames = 0;
+}
 
-  /* emu keys */
-  joypad.up = false;
+static void uninit_video(void) {
+  scaler.close();
+  SDL_DestroyTexture(display.frameBuffer);
+  SDL_DestroyRenderer(display.renderer);
+  SDL_DestroyWindow(display.screen);
+
+  SDL_Quit();
+}
+
+static void present_texture(void) {
+  SDL_RenderClear(display.renderer);
+  SDL_RenderCopy(display.renderer, display.frameBuffer, NULL, NULL);
+  SDL_RenderPresent(display.renderer);
+}
+
+static void present_pixels(const Uint32 *pixels) {
+  void *texture;
+  int pitch_bytes;
+  if (!cpu_scaling) {
+    SDL_UpdateTexture(display.frameBuffer, NULL, pixels,
+                      LCD_Width * sizeof(Uint32));
+  } else if (SDL_LockTexture(display.frameBuffer, NULL, &texture,
+                             &pitch_bytes) == 0) {
+    scaler.scale(pixels, (Uint32 *)texture, pitch_bytes / sizeof(Uint32));
+    SDL_UnlockTexture(display.frameBuffer);
+  }
+  present_texture();
+}
+
+static void present_loop(Sdl_params p) {
+  init_video(p);
+
+  SDL_Event event;
+  // events the queue had no room for yet
+  std::vector<SDL_Event> backlog;
+  while (!presenter.done.load(std::memory_order_acquire)) {
+    while (SDL_PollEvent(&event)) {
+      backlog.push_back(event);
+    }
+    size_t sent = 0;
+    while (sent < backlog.size() && presenter.events.push(backlog[sent])) {
+      sent++;
+    }
+    backlog.erase(backlog.begin(), backlog.begin() + sent);
+
+    const Uint32 *frame = presenter.frames.consume();
+    if (frame != nullptr) {
+      present_pixels(frame);
+    } else {
+      // the emulation thread doesn't take the lock to wake us, so a wakeup
+      // can be missed. the timeout bounds how late that frame (or input)
+      // gets picked up
+      std::unique_lock<std::mutex> l(presenter.lock);
+      presenter.cv.wait_for(l, std::chrono::milliseconds(1), [] {
+        return presenter.frames.fresh() || presenter.done.load();
+      });
+    }
+  }
+  // show the last frame published before shutdown
+  if (const Uint32 *frame = presenter.frames.consume()) {
+    present_pixels(frame);
+  }
+
+  uninit_video();
+}
+
+static void publish_frame(void) {
+  presenter.frames.publish();
+  presenter.cv.notify_one();
+}
+
+void sdl_init(Sdl_params p) {
+  /* emu keys. reset here rather than in init_video, which runs on the
+     presenter thread: they belong to the thread calling sdl_update
+   */
   joypad.up = false;
+  joypad.down = false;
   joypad.left = false;
-  joypad.left = false;
+  joypad.right = false;
   joypad.start = false;
   joypad.select = false;
   joypad.a = false;
@@ -62,119 +176,193 @@ void sdl_init(Sdl_params p) {
 
   /* emu control keys */
   emu_keys.pause = false;
+  emu_keys.turbo = false;
+
+  presenter.enabled = p.present_thread;
+  if (presenter.enabled) {
+    presenter.done = false;
+    presenter.thread = std::thread(present_loop, p);
+  } else {
+    init_video(p);
+  }
 }
 
 void sdl_uninit(void) {
+  if (presenter.enabled) {
+    presenter.done = true;
+    presenter.cv.notify_one();
+    presenter.thread.join();
+  } else {
+    uninit_video();
+  }
+}
 
-  SDL_DestroyTexture(display.frameBuffer);
-  SDL_DestroyRenderer(display.renderer);
-  SDL_DestroyWindow(display.screen);
-
-  SDL_Quit();
+Uint32 *sdl_lock_frame(int *pitch) {
+  if (presenter.enabled) {
+    *pitch = LCD_Width;
+    return presenter.frames.back_buffer();
+  }
+  void *pixels;
+  int pitch_bytes;
+  // a scaled texture is filled from the whole frame in sdl_set_frame
+  if (display.frameBuffer == nullptr || cpu_scaling ||
+      SDL_LockTexture(display.frameBuffer, NULL, &pixels, &pitch_bytes) < 0) {
+    *pitch = LCD_Width;
+    return display.pixels;
+  }
+  display.locked = true;
+  *pitch = pitch_bytes / sizeof(Uint32);
+  return (Uint32 *)pixels;
 }
 
 void sdl_set_frame(void) {
-  SDL_UpdateTexture(display.frameBuffer, NULL, display.pixels,
-                    LCD_Width * sizeof(uint32_t));
-  SDL_RenderClear(display.renderer);
-  SDL_RenderCopy(display.renderer, display.frameBuffer, NULL, NULL);
-  SDL_RenderPresent(display.renderer);
+  if (presenter.enabled) {
+    publish_frame();
+    return;
+  }
+  if (cpu_scaling) {
+    present_pixels(display.pixels);
+    return;
+  }
+  if (display.locked) {
+    SDL_UnlockTexture(display.frameBuffer);
+    display.locked = false;
+  }
+  present_texture();
 }
 
-int sdl_update(void) {
-  SDL_Event event;
-
-  while (SDL_PollEvent(&event)) {
+void sdl_present_pixels(const Uint32 *pixels) {
+  if (presenter.enabled) {
+    memcpy(presenter.frames.back_buffer(), pixels,
+           LCD_Width * LCD_Height * sizeof(Uint32));
+    publish_frame();
+    return;
+  }
+  present_pixels(pixels);
+}
 
-    switch (event.type) {
-    case SDL_QUIT:
-      return 1;
-    case SDL_KEYDOWN:
-      switch (event.key.keysym.sym) {
-      case SDLK_UP:
-        joypad.up = true;
-        break;
-      case SDLK_DOWN:
-        joypad.down = true;
-        break;
-      case SDLK_LEFT:
-        joypad.left = true;
-        break;
-      case SDLK_RIGHT:
-        joypad.right = true;
-        break;
-      case SDLK_RETURN:
-        joypad.start = true;
-        break;
-      case SDLK_RSHIFT:
-        joypad.select = true;
-        break;
-      case SDLK_a:
-        joypad.a = true;
-        break;
-      case SDLK_s:
-        joypad.b = true;
-        break;
-      case SDLK_ESCAPE:
-        return 1;
-      }
+// applies one SDL event to the joypad and emu keys. key changes are appended
+// to input. returns 1 on quit
+static int handle_event(const SDL_Event &event,
+                        std::vector<Input_Change> &input) {
+  switch (event.type) {
+  case SDL_QUIT:
+    return 1;
+  case SDL_KEYDOWN:
+    switch (event.key.keysym.sym) {
+    case SDLK_UP:
+      joypad.up = true;
       break;
-    case SDL_KEYUP:
-      switch (event.key.keysym.sym) {
-      case SDLK_UP:
-        joypad.up = false;
-        break;
-      case SDLK_DOWN:
-        joypad.down = false;
-        break;
-      case SDLK_LEFT:
-        joypad.left = false;
-        break;
-      case SDLK_RIGHT:
-        joypad.right = false;
-        break;
-      case SDLK_RETURN:
-        joypad.start = false;
-        break;
-      case SDLK_RSHIFT:
-        joypad.select = false;
-        break;
-      case SDLK_a:
-        joypad.a = false;
-        break;
-      case SDLK_s:
-        joypad.b = false;
-        break;
-
-      /* emu control keys */
-      case SDLK_p:
-        emu_keys.pause = !(emu_keys.pause);
-        break;
-      case SDLK_w:
-        emu_keys.save_ram = true;
-        break;
-      case SDLK_l:
-        emu_keys.load_ram = true;
-        break;
-      case SDLK_ESCAPE:
-        return 1;
-      }
+    case SDLK_DOWN:
+      joypad.down = true;
+      break;
+    case SDLK_LEFT:
+      joypad.left = true;
+      break;
+    case SDLK_RIGHT:
+      joypad.right = true;
+      break;
+    case SDLK_RETURN:
+      joypad.start = true;
+      break;
+    case SDLK_RSHIFT:
+      joypad.select = true;
+      break;
+    case SDLK_a:
+      joypad.a = true;
       break;
+    case SDLK_s:
+      joypad.b = true;
+      break;
+    case SDLK_TAB:
+      emu_keys.turbo = true;
+      break;
+    case SDLK_ESCAPE:
+      return 1;
     }
+    break;
+  case SDL_KEYUP:
+    switch (event.key.keysym.sym) {
+    case SDLK_UP:
+      joypad.up = false;
+      break;
+    case SDLK_DOWN:
+      joypad.down = false;
+      break;
+    case SDLK_LEFT:
+      joypad.left = false;
+      break;
+    case SDLK_RIGHT:
+      joypad.right = false;
+      break;
+    case SDLK_RETURN:
+      joypad.start = false;
+      break;
+    case SDLK_RSHIFT:
+      joypad.select = false;
+      break;
+    case SDLK_a:
+      joypad.a = false;
+      break;
+    case SDLK_s:
+      joypad.b = false;
+      break;
+    case SDLK_TAB:
+      emu_keys.turbo = false;
+      break;
 
-    buttons = (joypad.a << 0) | (joypad.b << 1) | (joypad.select << 2) |
-              (joypad.start << 3);
-    direction = (joypad.right << 0) | (joypad.left << 1) | (joypad.up << 2) |
-                (joypad.down << 3);
-
-    if (event.type == SDL_QUIT)
+    /* emu control keys */
+    case SDLK_p:
+      emu_keys.pause = !(emu_keys.pause);
+      break;
+    case SDLK_w:
+      emu_keys.save_ram = true;
+      break;
+    case SDLK_l:
+      emu_keys.load_ram = true;
+      break;
+    case SDLK_ESCAPE:
       return 1;
+    }
+    break;
+  }
+
+  Input_Change change;
+  change.buttons = (joypad.a << 0) | (joypad.b << 1) | (joypad.select << 2) |
+                   (joypad.start << 3);
+  change.direction = (joypad.right << 0) | (joypad.left << 1) |
+                     (joypad.up << 2) | (joypad.down << 3);
+  if (change.buttons != reported.buttons ||
+      change.direction != reported.direction) {
+    // event timestamps are SDL_GetTicks milliseconds
+    change.time = std::chrono::steady_clock::now() -
+                  std::chrono::milliseconds(SDL_GetTicks() -
+                                            event.key.timestamp);
+    input.push_back(change);
+    reported = change;
   }
+
+  if (event.type == SDL_QUIT)
+    return 1;
   return 0;
 }
 
-void set_sdl_pixels(const unsigned char *gb_pixels) {
-  for (int i = 0; i < LCD_Width * LCD_Height; i++) {
-    display.pixels[i] = Palette[gb_pixels[i]];
+int sdl_update(std::vector<Input_Change> &input) {
+  SDL_Event event;
+
+  if (presenter.enabled) {
+    while (presenter.events.pop(event)) {
+      if (handle_event(event, input)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  while (SDL_PollEvent(&event)) {
+    if (handle_event(event, input)) {
+      return 1;
+    }
   }
+  return 0;
 }
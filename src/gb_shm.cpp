@@ -0,0 +1,105 @@
+#include "gb_shm.h"
+#include "gb_joypad.h"
+#include "gb_sdl.h"
+#include "gb_simd.h"
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+ShmExport::~ShmExport() { close(); }
+
+bool ShmExport::open(const std::string &name) {
+  // shm_open wants a single leading slash
+  this->name = (name.empty() || name[0] != '/') ? "/" + name : name;
+  int fd = shm_open(this->name.c_str(), O_CREAT | O_RDWR, 0600);
+  if (fd < 0) {
+    std::cerr << "GBcon: can't create shared memory " << this->name << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  // slots start on a cache line, pixels follow their 32 byte header
+  size_t frame_offset = (sizeof(Shm_Header) + 63) & ~(size_t)63;
+  size_t frame_size = (sizeof(Shm_Frame) + 63) & ~(size_t)63;
+  size = frame_offset + Shm_Slots * frame_size;
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    std::cerr << "GBcon: can't map shared memory " << this->name << ": "
+              << strerror(errno) << std::endl;
+    shm_unlink(this->name.c_str());
+    return false;
+  }
+
+  // a segment left behind by an earlier run is started over
+  memset(p, 0, size);
+  header = (Shm_Header *)p;
+  header->version = Shm_Version;
+  header->width = Shm_Width;
+  header->height = Shm_Height;
+  header->slots = Shm_Slots;
+  header->frame_offset = frame_offset;
+  header->frame_size = frame_size;
+  header->pid = getpid();
+  // tells readers the rest is filled in
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, Shm_Magic, sizeof(Shm_Magic));
+  return true;
+}
+
+void ShmExport::close(void) {
+  if (header == nullptr) {
+    return;
+  }
+  munmap(header, size);
+  shm_unlink(name.c_str());
+  header = nullptr;
+}
+
+void ShmExport::publish(const unsigned char *shades, unsigned long frame,
+                        unsigned long long cycle) {
+  uint32_t n = header->published.load(std::memory_order_relaxed);
+  Shm_Frame *slot = (Shm_Frame *)((char *)header + header->frame_offset +
+                                  (n % Shm_Slots) * header->frame_size);
+
+  // seqlock write: odd while the slot is inconsistent
+  uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  slot->frame = frame;
+  slot->cycle = cycle;
+  slot->host_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  gb_simd::kernels->expand_argb(shades, slot->pixels, Shm_Width * Shm_Height,
+                                Palette);
+  slot->seq.store(seq + 2, std::memory_order_release);
+
+  // seq_cst on both sides: the store must be seen before waiters is read,
+  // or a reader that just went to sleep on the old count is never woken
+  header->published.store(n + 1, std::memory_order_seq_cst);
+  // a futex wake is a syscall. only make it when a reader sleeps
+  if (header->waiters.load(std::memory_order_seq_cst) != 0) {
+    syscall(SYS_futex, &header->published, FUTEX_WAKE, INT_MAX, nullptr,
+            nullptr, 0);
+  }
+}
+
+void ShmExport::apply_input(Joypad *joypad, unsigned long long cycle,
+                            uint32_t keys) {
+  if (keys & Shm_Input_Active) {
+    joypad->schedule(cycle, keys & 0x0F, (keys >> 4) & 0x0F);
+  } else if (last_input & Shm_Input_Active) {
+    // the client let go
+    joypad->schedule(cycle, 0, 0);
+  }
+  last_input = keys;
+}
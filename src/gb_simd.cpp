@@ -0,0 +1,541 @@
+#include "gb_simd.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GB_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace gb_simd {
+
+/* scalar
+ */
+
+// a plane byte spread over 8 bytes of 0 or 1, leftmost pixel (bit 7) first
+struct Spread_Table {
+  uint64_t rows[256];
+  Spread_Table() {
+    for (unsigned int b = 0; b < 256; b++) {
+      unsigned char bytes[8];
+      for (unsigned int j = 0; j < 8; j++) {
+        bytes[j] = (b >> (7 - j)) & 1;
+      }
+      memcpy(&rows[b], bytes, sizeof(bytes));
+    }
+  }
+};
+static const Spread_Table Spread;
+
+static void decode_tile_rows_scalar(const unsigned char *data,
+                                    unsigned char *out, size_t rows) {
+  for (size_t r = 0; r < rows; r++) {
+    // bytes are 0 or 1, so the shift can't carry into the next pixel
+    uint64_t px = Spread.rows[data[2 * r]] | Spread.rows[data[2 * r + 1]] << 1;
+    memcpy(out + 8 * r, &px, sizeof(px));
+  }
+}
+
+static void map_palette_scalar(const unsigned char *in, unsigned char *out,
+                               size_t n, unsigned char palette) {
+  const unsigned char shade[4] = {
+      (unsigned char)(palette & 0x03), (unsigned char)((palette >> 2) & 0x03),
+      (unsigned char)((palette >> 4) & 0x03), (unsigned char)(palette >> 6)};
+  for (size_t i = 0; i < n; i++) {
+    out[i] = shade[in[i]];
+  }
+}
+
+static void expand_argb_scalar(const unsigned char *in, unsigned int *out,
+                               size_t n, const unsigned int colors[4]) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = colors[in[i]];
+  }
+}
+
+static void scale_row_scalar(const unsigned int *in, unsigned int *out,
+                             size_t n, unsigned int factor) {
+  for (size_t i = 0; i < n; i++) {
+    for (unsigned int k = 0; k < factor; k++) {
+      *out++ = in[i];
+    }
+  }
+}
+
+/* Scale2x/Scale3x name the 3x3 neighbourhood of each pixel E
+
+     A B C
+     D E F
+     G H I
+
+   and give a corner of E's block a neighbour's color where two matching
+   edges meet there. nothing changes unless B != H and D != F
+ */
+
+static void scale2x_row_scalar(const unsigned int *above,
+                               const unsigned int *row,
+                               const unsigned int *below,
+                               unsigned int *const out[2], size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned int b = above[i], d = row[i - 1], e = row[i], f = row[i + 1],
+                 h = below[i];
+    if (b != h && d != f) {
+      out[0][2 * i] = d == b ? d : e;
+      out[0][2 * i + 1] = b == f ? f : e;
+      out[1][2 * i] = d == h ? d : e;
+      out[1][2 * i + 1] = h == f ? f : e;
+    } else {
+      out[0][2 * i] = out[0][2 * i + 1] = e;
+      out[1][2 * i] = out[1][2 * i + 1] = e;
+    }
+  }
+}
+
+static void scale3x_row_scalar(const unsigned int *above,
+                               const unsigned int *row,
+                               const unsigned int *below,
+                               unsigned int *const out[3], size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned int a = above[i - 1], b = above[i], c = above[i + 1];
+    unsigned int d = row[i - 1], e = row[i], f = row[i + 1];
+    unsigned int g = below[i - 1], h = below[i], k = below[i + 1];
+    unsigned int *o0 = &out[0][3 * i], *o1 = &out[1][3 * i],
+                 *o2 = &out[2][3 * i];
+    if (b != h && d != f) {
+      o0[0] = d == b ? d : e;
+      o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+      o0[2] = b == f ? f : e;
+      o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+      o1[1] = e;
+      o1[2] = (b == f && e != k) || (h == f && e != c) ? f : e;
+      o2[0] = d == h ? d : e;
+      o2[1] = (d == h && e != k) || (h == f && e != g) ? h : e;
+      o2[2] = h == f ? f : e;
+    } else {
+      o0[0] = o0[1] = o0[2] = e;
+      o1[0] = o1[1] = o1[2] = e;
+      o2[0] = o2[1] = o2[2] = e;
+    }
+  }
+}
+
+static const Kernels Scalar_Kernels = {
+    "scalar", decode_tile_rows_scalar, map_palette_scalar,
+    expand_argb_scalar, scale_row_scalar, scale2x_row_scalar,
+    scale3x_row_scalar};
+
+#ifdef GB_SIMD_X86
+
+/* SSE2
+ */
+
+// bit j of each byte -> byte j (leftmost pixel is bit 7)
+static const unsigned char Pixel_Bits[16] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04,
+                                             0x02, 0x01, 0x80, 0x40, 0x20, 0x10,
+                                             0x08, 0x04, 0x02, 0x01};
+
+__attribute__((target("sse2")))
+static void decode_tile_rows_sse2(const unsigned char *data,
+                                  unsigned char *out, size_t rows) {
+  const __m128i bits = _mm_loadu_si128((const __m128i *)Pixel_Bits);
+  const __m128i one = _mm_set1_epi8(1);
+  size_t r = 0;
+  // two rows per iteration: broadcast each plane byte over its row's 8 lanes
+  for (; r + 2 <= rows; r += 2) {
+    const unsigned char *d = data + 2 * r;
+    __m128i lo = _mm_set_epi64x(0x0101010101010101ull * d[2],
+                                0x0101010101010101ull * d[0]);
+    __m128i hi = _mm_set_epi64x(0x0101010101010101ull * d[3],
+                                0x0101010101010101ull * d[1]);
+    __m128i lo_set = _mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits);
+    __m128i hi_set = _mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits);
+    __m128i px = _mm_add_epi8(_mm_and_si128(lo_set, one),
+                              _mm_and_si128(hi_set, _mm_add_epi8(one, one)));
+    _mm_storeu_si128((__m128i *)(out + 8 * r), px);
+  }
+  decode_tile_rows_scalar(data + 2 * r, out + 8 * r, rows - r);
+}
+
+__attribute__((target("sse2")))
+static void map_palette_sse2(const unsigned char *in, unsigned char *out,
+                             size_t n, unsigned char palette) {
+  // no byte shuffle in SSE2. select each of the 4 shades by compare
+  __m128i shade[4], num[4];
+  for (int k = 0; k < 4; k++) {
+    shade[k] = _mm_set1_epi8((palette >> (2 * k)) & 0x03);
+    num[k] = _mm_set1_epi8(k);
+  }
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i c = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i px = _mm_setzero_si128();
+    for (int k = 0; k < 4; k++) {
+      px = _mm_or_si128(px, _mm_and_si128(_mm_cmpeq_epi8(c, num[k]), shade[k]));
+    }
+    _mm_storeu_si128((__m128i *)(out + i), px);
+  }
+  map_palette_scalar(in + i, out + i, n - i, palette);
+}
+
+__attribute__((target("sse2")))
+static void expand_argb_sse2(const unsigned char *in, unsigned int *out,
+                             size_t n, const unsigned int colors[4]) {
+  __m128i color[4], num[4];
+  for (int k = 0; k < 4; k++) {
+    color[k] = _mm_set1_epi32(colors[k]);
+    num[k] = _mm_set1_epi32(k);
+  }
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i s8 = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i s16[2] = {_mm_unpacklo_epi8(s8, zero), _mm_unpackhi_epi8(s8, zero)};
+    for (int h = 0; h < 2; h++) {
+      __m128i s32[2] = {_mm_unpacklo_epi16(s16[h], zero),
+                        _mm_unpackhi_epi16(s16[h], zero)};
+      for (int q = 0; q < 2; q++) {
+        __m128i px = _mm_setzero_si128();
+        for (int k = 0; k < 4; k++) {
+          px = _mm_or_si128(
+              px, _mm_and_si128(_mm_cmpeq_epi32(s32[q], num[k]), color[k]));
+        }
+        _mm_storeu_si128((__m128i *)(out + i + 8 * h + 4 * q), px);
+      }
+    }
+  }
+  expand_argb_scalar(in + i, out + i, n - i, colors);
+}
+
+__attribute__((target("sse2")))
+static void scale_row_sse2(const unsigned int *in, unsigned int *out,
+                           size_t n, unsigned int factor) {
+  size_t i = 0;
+  // 4 pixels in, factor vectors out. lane j of vector v is pixel (4v+j)/factor
+  switch (factor) {
+  case 2:
+    for (; i + 4 <= n; i += 4, out += 8) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(in + i));
+      _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi32(p, p));
+      _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi32(p, p));
+    }
+    break;
+  case 3:
+    for (; i + 4 <= n; i += 4, out += 12) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(in + i));
+      _mm_storeu_si128((__m128i *)out,
+                       _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 0, 0, 0)));
+      _mm_storeu_si128((__m128i *)(out + 4),
+                       _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 1, 1)));
+      _mm_storeu_si128((__m128i *)(out + 8),
+                       _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 2)));
+    }
+    break;
+  case 4:
+    for (; i + 4 <= n; i += 4, out += 16) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(in + i));
+      _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi32(p, 0x00));
+      _mm_storeu_si128((__m128i *)(out + 4), _mm_shuffle_epi32(p, 0x55));
+      _mm_storeu_si128((__m128i *)(out + 8), _mm_shuffle_epi32(p, 0xAA));
+      _mm_storeu_si128((__m128i *)(out + 12), _mm_shuffle_epi32(p, 0xFF));
+    }
+    break;
+  }
+  scale_row_scalar(in + i, out, n - i, factor);
+}
+
+// mask ? x : e
+__attribute__((target("sse2")))
+static inline __m128i select_sse2(__m128i mask, __m128i x, __m128i e) {
+  return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, e));
+}
+
+__attribute__((target("sse2")))
+static void scale2x_row_sse2(const unsigned int *above,
+                             const unsigned int *row,
+                             const unsigned int *below,
+                             unsigned int *const out[2], size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i b = _mm_loadu_si128((const __m128i *)(above + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(row + i - 1));
+    __m128i e = _mm_loadu_si128((const __m128i *)(row + i));
+    __m128i f = _mm_loadu_si128((const __m128i *)(row + i + 1));
+    __m128i h = _mm_loadu_si128((const __m128i *)(below + i));
+    // B != H && D != F
+    __m128i edge = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)),
+        _mm_set1_epi32(-1));
+    __m128i e0 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi32(d, b)), d, e);
+    __m128i e1 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi32(b, f)), f, e);
+    __m128i e2 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi32(d, h)), d, e);
+    __m128i e3 = select_sse2(_mm_and_si128(edge, _mm_cmpeq_epi32(h, f)), f, e);
+    _mm_storeu_si128((__m128i *)(out[0] + 2 * i), _mm_unpacklo_epi32(e0, e1));
+    _mm_storeu_si128((__m128i *)(out[0] + 2 * i + 4),
+                     _mm_unpackhi_epi32(e0, e1));
+    _mm_storeu_si128((__m128i *)(out[1] + 2 * i), _mm_unpacklo_epi32(e2, e3));
+    _mm_storeu_si128((__m128i *)(out[1] + 2 * i + 4),
+                     _mm_unpackhi_epi32(e2, e3));
+  }
+  unsigned int *const rest[2] = {out[0] + 2 * i, out[1] + 2 * i};
+  scale2x_row_scalar(above + i, row + i, below + i, rest, n - i);
+}
+
+// x0 y0 z0 x1 y1 z1 ... from x, y and z
+__attribute__((target("sse2")))
+static inline void store3_sse2(unsigned int *out, __m128i x, __m128i y,
+                               __m128i z) {
+  __m128 lo = _mm_castsi128_ps(_mm_unpacklo_epi32(x, y)); // x0 y0 x1 y1
+  __m128 hi = _mm_castsi128_ps(_mm_unpackhi_epi32(x, y)); // x2 y2 x3 y3
+  __m128 zf = _mm_castsi128_ps(z);
+  __m128 t0 = _mm_shuffle_ps(zf, lo, _MM_SHUFFLE(3, 2, 0, 0));
+  __m128 t1 = _mm_shuffle_ps(lo, zf, _MM_SHUFFLE(1, 1, 3, 3));
+  __m128 t2 = _mm_shuffle_ps(zf, hi, _MM_SHUFFLE(3, 2, 3, 2));
+  _mm_storeu_ps((float *)out, _mm_shuffle_ps(lo, t0, _MM_SHUFFLE(2, 0, 1, 0)));
+  _mm_storeu_ps((float *)(out + 4),
+                _mm_shuffle_ps(t1, hi, _MM_SHUFFLE(1, 0, 2, 0)));
+  _mm_storeu_ps((float *)(out + 8),
+                _mm_shuffle_ps(t2, t2, _MM_SHUFFLE(1, 3, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+static void scale3x_row_sse2(const unsigned int *above,
+                             const unsigned int *row,
+                             const unsigned int *below,
+                             unsigned int *const out[3], size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(above + i - 1));
+    __m128i b = _mm_loadu_si128((const __m128i *)(above + i));
+    __m128i c = _mm_loadu_si128((const __m128i *)(above + i + 1));
+    __m128i d = _mm_loadu_si128((const __m128i *)(row + i - 1));
+    __m128i e = _mm_loadu_si128((const __m128i *)(row + i));
+    __m128i f = _mm_loadu_si128((const __m128i *)(row + i + 1));
+    __m128i g = _mm_loadu_si128((const __m128i *)(below + i - 1));
+    __m128i h = _mm_loadu_si128((const __m128i *)(below + i));
+    __m128i k = _mm_loadu_si128((const __m128i *)(below + i + 1));
+    __m128i edge = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)),
+        _mm_set1_epi32(-1));
+    // the four corner conditions, and E differing from each corner pixel
+    __m128i db = _mm_and_si128(edge, _mm_cmpeq_epi32(d, b));
+    __m128i bf = _mm_and_si128(edge, _mm_cmpeq_epi32(b, f));
+    __m128i dh = _mm_and_si128(edge, _mm_cmpeq_epi32(d, h));
+    __m128i hf = _mm_and_si128(edge, _mm_cmpeq_epi32(h, f));
+    __m128i ea = _mm_cmpeq_epi32(e, a), ec = _mm_cmpeq_epi32(e, c);
+    __m128i eg = _mm_cmpeq_epi32(e, g), ek = _mm_cmpeq_epi32(e, k);
+
+    __m128i o0 = select_sse2(db, d, e);
+    __m128i o1 = select_sse2(
+        _mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), b, e);
+    __m128i o2 = select_sse2(bf, f, e);
+    __m128i o3 = select_sse2(
+        _mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), d, e);
+    __m128i o5 = select_sse2(
+        _mm_or_si128(_mm_andnot_si128(ek, bf), _mm_andnot_si128(ec, hf)), f, e);
+    __m128i o6 = select_sse2(dh, d, e);
+    __m128i o7 = select_sse2(
+        _mm_or_si128(_mm_andnot_si128(ek, dh), _mm_andnot_si128(eg, hf)), h, e);
+    __m128i o8 = select_sse2(hf, f, e);
+    store3_sse2(out[0] + 3 * i, o0, o1, o2);
+    store3_sse2(out[1] + 3 * i, o3, e, o5);
+    store3_sse2(out[2] + 3 * i, o6, o7, o8);
+  }
+  unsigned int *const rest[3] = {out[0] + 3 * i, out[1] + 3 * i,
+                                 out[2] + 3 * i};
+  scale3x_row_scalar(above + i, row + i, below + i, rest, n - i);
+}
+
+static const Kernels Sse2_Kernels = {
+    "sse2", decode_tile_rows_sse2, map_palette_sse2,
+    expand_argb_sse2, scale_row_sse2, scale2x_row_sse2,
+    scale3x_row_sse2};
+
+/* AVX2
+ */
+
+__attribute__((target("avx2")))
+static void decode_tile_rows_avx2(const unsigned char *data,
+                                  unsigned char *out, size_t rows) {
+  const __m256i bits =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)Pixel_Bits));
+  const __m256i one = _mm256_set1_epi8(1);
+  // shuffle that copies plane byte 2*row (lo) or 2*row+1 (hi) to 8 lanes
+  const __m256i lo_sel = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+                                          2, 2, 2, 2, 2, 2, 2, 2,
+                                          0, 0, 0, 0, 0, 0, 0, 0,
+                                          2, 2, 2, 2, 2, 2, 2, 2);
+  const __m256i hi_sel = _mm256_add_epi8(lo_sel, one);
+  size_t r = 0;
+  // four rows (8 bytes of tile data) per iteration
+  for (; r + 4 <= rows; r += 4) {
+    const unsigned char *d = data + 2 * r;
+    __m256i src = _mm256_setr_epi32(d[0] | d[1] << 8 | d[2] << 16 | d[3] << 24,
+                                    0, 0, 0,
+                                    d[4] | d[5] << 8 | d[6] << 16 | d[7] << 24,
+                                    0, 0, 0);
+    __m256i lo = _mm256_shuffle_epi8(src, lo_sel);
+    __m256i hi = _mm256_shuffle_epi8(src, hi_sel);
+    __m256i lo_set = _mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits);
+    __m256i hi_set = _mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits);
+    __m256i px = _mm256_add_epi8(
+        _mm256_and_si256(lo_set, one),
+        _mm256_and_si256(hi_set, _mm256_add_epi8(one, one)));
+    _mm256_storeu_si256((__m256i *)(out + 8 * r), px);
+  }
+  // the rest runs legacy SSE code. dirty upper halves would make every
+  // SSE instruction there pay for the AVX state
+  _mm256_zeroupper();
+  decode_tile_rows_sse2(data + 2 * r, out + 8 * r, rows - r);
+}
+
+__attribute__((target("avx2")))
+static void map_palette_avx2(const unsigned char *in, unsigned char *out,
+                             size_t n, unsigned char palette) {
+  // 4 entry shuffle lookup. color numbers are always 0-3
+  __m128i lut = _mm_setr_epi8(palette & 0x03, (palette >> 2) & 0x03,
+                              (palette >> 4) & 0x03, (palette >> 6) & 0x03,
+                              0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i table = _mm256_broadcastsi128_si256(lut);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)(in + i));
+    _mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(table, c));
+  }
+  _mm256_zeroupper();
+  map_palette_sse2(in + i, out + i, n - i, palette);
+}
+
+__attribute__((target("avx2")))
+static void expand_argb_avx2(const unsigned char *in, unsigned int *out,
+                             size_t n, const unsigned int colors[4]) {
+  const __m256i table = _mm256_setr_epi32(colors[0], colors[1], colors[2],
+                                          colors[3], 0, 0, 0, 0);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + i)));
+    _mm256_storeu_si256((__m256i *)(out + i),
+                        _mm256_permutevar8x32_epi32(table, idx));
+  }
+  _mm256_zeroupper();
+  expand_argb_scalar(in + i, out + i, n - i, colors);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i select_avx2(__m256i mask, __m256i x, __m256i e) {
+  return _mm256_blendv_epi8(e, x, mask);
+}
+
+// x0 y0 z0 x1 y1 z1 ... from x, y and z
+__attribute__((target("avx2")))
+static inline void store3_avx2(unsigned int *out, __m256i x, __m256i y,
+                               __m256i z) {
+  // output lane j of vector v is pixel (8v+j)/3 of x, y or z by (8v+j)%3
+  const __m256i idx0 = _mm256_setr_epi32(0, 0, 0, 1, 1, 1, 2, 2);
+  const __m256i idx1 = _mm256_setr_epi32(2, 3, 3, 3, 4, 4, 4, 5);
+  const __m256i idx2 = _mm256_setr_epi32(5, 5, 6, 6, 6, 7, 7, 7);
+  __m256i v0 = _mm256_permutevar8x32_epi32(x, idx0);
+  v0 = _mm256_blend_epi32(v0, _mm256_permutevar8x32_epi32(y, idx0), 0x92);
+  v0 = _mm256_blend_epi32(v0, _mm256_permutevar8x32_epi32(z, idx0), 0x24);
+  __m256i v1 = _mm256_permutevar8x32_epi32(x, idx1);
+  v1 = _mm256_blend_epi32(v1, _mm256_permutevar8x32_epi32(y, idx1), 0x24);
+  v1 = _mm256_blend_epi32(v1, _mm256_permutevar8x32_epi32(z, idx1), 0x49);
+  __m256i v2 = _mm256_permutevar8x32_epi32(x, idx2);
+  v2 = _mm256_blend_epi32(v2, _mm256_permutevar8x32_epi32(y, idx2), 0x49);
+  v2 = _mm256_blend_epi32(v2, _mm256_permutevar8x32_epi32(z, idx2), 0x92);
+  _mm256_storeu_si256((__m256i *)out, v0);
+  _mm256_storeu_si256((__m256i *)(out + 8), v1);
+  _mm256_storeu_si256((__m256i *)(out + 16), v2);
+}
+
+__attribute__((target("avx2")))
+static void scale3x_row_avx2(const unsigned int *above,
+                             const unsigned int *row,
+                             const unsigned int *below,
+                             unsigned int *const out[3], size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(above + i - 1));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(above + i));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(above + i + 1));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(row + i - 1));
+    __m256i e = _mm256_loadu_si256((const __m256i *)(row + i));
+    __m256i f = _mm256_loadu_si256((const __m256i *)(row + i + 1));
+    __m256i g = _mm256_loadu_si256((const __m256i *)(below + i - 1));
+    __m256i h = _mm256_loadu_si256((const __m256i *)(below + i));
+    __m256i k = _mm256_loadu_si256((const __m256i *)(below + i + 1));
+    __m256i edge = _mm256_andnot_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi32(b, h), _mm256_cmpeq_epi32(d, f)),
+        _mm256_set1_epi32(-1));
+    __m256i db = _mm256_and_si256(edge, _mm256_cmpeq_epi32(d, b));
+    __m256i bf = _mm256_and_si256(edge, _mm256_cmpeq_epi32(b, f));
+    __m256i dh = _mm256_and_si256(edge, _mm256_cmpeq_epi32(d, h));
+    __m256i hf = _mm256_and_si256(edge, _mm256_cmpeq_epi32(h, f));
+    __m256i ea = _mm256_cmpeq_epi32(e, a), ec = _mm256_cmpeq_epi32(e, c);
+    __m256i eg = _mm256_cmpeq_epi32(e, g), ek = _mm256_cmpeq_epi32(e, k);
+
+    __m256i o0 = select_avx2(db, d, e);
+    __m256i o1 = select_avx2(_mm256_or_si256(_mm256_andnot_si256(ec, db),
+                                             _mm256_andnot_si256(ea, bf)),
+                             b, e);
+    __m256i o2 = select_avx2(bf, f, e);
+    __m256i o3 = select_avx2(_mm256_or_si256(_mm256_andnot_si256(eg, db),
+                                             _mm256_andnot_si256(ea, dh)),
+                             d, e);
+    __m256i o5 = select_avx2(_mm256_or_si256(_mm256_andnot_si256(ek, bf),
+                                             _mm256_andnot_si256(ec, hf)),
+                             f, e);
+    __m256i o6 = select_avx2(dh, d, e);
+    __m256i o7 = select_avx2(_mm256_or_si256(_mm256_andnot_si256(ek, dh),
+                                             _mm256_andnot_si256(eg, hf)),
+                             h, e);
+    __m256i o8 = select_avx2(hf, f, e);
+    store3_avx2(out[0] + 3 * i, o0, o1, o2);
+    store3_avx2(out[1] + 3 * i, o3, e, o5);
+    store3_avx2(out[2] + 3 * i, o6, o7, o8);
+  }
+  unsigned int *const rest[3] = {out[0] + 3 * i, out[1] + 3 * i,
+                                 out[2] + 3 * i};
+  _mm256_zeroupper();
+  scale3x_row_sse2(above + i, row + i, below + i, rest, n - i);
+}
+
+// pixel repeating and Scale2x are bound by their stores. 256 bit versions
+// were slower than SSE2 (their loads at x-1 and x+1 split cache lines twice
+// as often), so those stay SSE2
+static const Kernels Avx2_Kernels = {
+    "avx2", decode_tile_rows_avx2, map_palette_avx2,
+    expand_argb_avx2, scale_row_sse2, scale2x_row_sse2,
+    scale3x_row_avx2};
+
+#endif // GB_SIMD_X86
+
+const Kernels *get_kernels(Isa isa) {
+  switch (isa) {
+  case SCALAR:
+    return &Scalar_Kernels;
+#ifdef GB_SIMD_X86
+  case SSE2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") ? &Sse2_Kernels : nullptr;
+  case AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? &Avx2_Kernels : nullptr;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+static const Kernels *select_kernels(void) {
+  if (const Kernels *k = get_kernels(AVX2)) {
+    return k;
+  }
+  if (const Kernels *k = get_kernels(SSE2)) {
+    return k;
+  }
+  return &Scalar_Kernels;
+}
+
+const Kernels *kernels = select_kernels();
+
+} // namespace gb_simd
@@ -0,0 +1,65 @@
+#include "gb_state.h"
+#include "gb_cart.h"
+#include "gb_cpu.h"
+#include "gb_int.h"
+#include "gb_joypad.h"
+#include "gb_lcd.h"
+#include "gb_memory.h"
+#include "gb_timer.h"
+
+void SaveState::init(GB_Sys *gb_sys) { sys = *gb_sys; }
+
+void SaveState::state(Snapshot &s) {
+  char magic[sizeof(State_Magic)];
+  memcpy(magic, State_Magic, sizeof(magic));
+  unsigned int version = State_Version;
+  unsigned int rom_checksum = sys.cart->rom_checksum;
+  s.io(magic);
+  s.io(version);
+  s.io(rom_checksum);
+  if (s.is_loading() &&
+      (memcmp(magic, State_Magic, sizeof(magic)) != 0 ||
+       version != State_Version || rom_checksum != sys.cart->rom_checksum)) {
+    // not one of ours. nothing has been touched yet
+    s.fail();
+    return;
+  }
+  sys.cpu->state(s);
+  sys.mem->state(s);
+  sys.cart->state(s);
+  sys.lcd->state(s);
+  sys.timer->state(s);
+  sys.interrupt->state(s);
+  sys.joypad->state(s);
+}
+
+void SaveState::save(void) {
+  snapshot.begin_save();
+  state(snapshot);
+}
+
+void SaveState::load(void) {
+  memcpy(old_vram, sys.mem->vram, sizeof(old_vram));
+  memcpy(old_oam, sys.mem->oram, sizeof(old_oam));
+  snapshot.begin_load();
+  state(snapshot);
+  sys.lcd->refresh_renderer(old_vram, old_oam);
+}
+
+bool SaveState::load_bytes(const unsigned char *p, size_t len) {
+  undo.begin_save();
+  state(undo);
+  // a load cuts serial output to the state's length, and undo can't grow
+  // it back
+  std::vector<char> serial_data = sys.mem->serial_data;
+  snapshot.assign(p, len);
+  load();
+  if (snapshot.loaded_all()) {
+    return true;
+  }
+  // put back whatever the partial load changed
+  snapshot = undo;
+  load();
+  sys.mem->serial_data.swap(serial_data);
+  return false;
+}
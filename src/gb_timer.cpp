@@ -2,6 +2,7 @@
 #include "gb_cpu.h"
 #include "gb_sdl.h"
 #include "gb_int.h"
+#include "gb_state.h"
 
 unsigned char Timer::get_tac(void) {
   unsigned char tac_byte = 0;
@@ -82,3 +83,16 @@ void Timer::init(GB_Sys *gb_sys) {
   cpu = gb_sys->cpu;
   interrupt = gb_sys->interrupt;
 }
+
+void Timer::state(Snapshot &s) {
+  s.io(div);
+  s.io(tima);
+  s.io(tma);
+  s.io(tac);
+  s.io(prev_ticks);
+  s.io(sum_ticks);
+  s.io(timer_en);
+  s.io(input_clk);
+  s.io(div_clk);
+  s.io(timer_ticks);
+}
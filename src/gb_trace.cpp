@@ -0,0 +1,130 @@
+#include "gb_trace.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+int format_doctor_line(char *buf, size_t len, const Trace_Entry &e) {
+  return snprintf(buf, len,
+                  "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X "
+                  "SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+                  e.a, e.f, e.b, e.c, e.d, e.e, e.h, e.l, e.sp, e.pc,
+                  e.pcmem[0], e.pcmem[1], e.pcmem[2], e.pcmem[3]);
+}
+
+bool parse_doctor_line(const char *line, Trace_Entry &e) {
+  unsigned v[14];
+  int n = sscanf(line,
+                 "A:%x F:%x B:%x C:%x D:%x E:%x H:%x L:%x SP:%x PC:%x "
+                 "PCMEM:%x,%x,%x,%x",
+                 &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7],
+                 &v[8], &v[9], &v[10], &v[11], &v[12], &v[13]);
+  if (n != 14) {
+    return false;
+  }
+  e = Trace_Entry{(unsigned char)v[0], (unsigned char)v[1],
+                  (unsigned char)v[2], (unsigned char)v[3],
+                  (unsigned char)v[4], (unsigned char)v[5],
+                  (unsigned char)v[6], (unsigned char)v[7],
+                  (unsigned short)v[8], (unsigned short)v[9],
+                  {(unsigned char)v[10], (unsigned char)v[11],
+                   (unsigned char)v[12], (unsigned char)v[13]}};
+  return true;
+}
+
+TraceWriter::~TraceWriter() { close(); }
+
+bool TraceWriter::open(const std::string &path) {
+  out = fopen(path.c_str(), "wb");
+  if (out == nullptr) {
+    std::cerr << "GBcon: could not open trace file " << path << std::endl;
+    return false;
+  }
+  // the writer thread does large writes itself. no need for stdio buffering
+  setvbuf(out, nullptr, _IONBF, 0);
+  if (fwrite(Trace_Magic, sizeof(Trace_Magic), 1, out) != 1) {
+    std::cerr << "GBcon: could not write trace file " << path << ": "
+              << strerror(errno) << std::endl;
+    fclose(out);
+    out = nullptr;
+    return false;
+  }
+  this->path = path;
+  failed = false;
+
+  for (auto &b : buffers) {
+    b.resize(Buffer_Entries);
+  }
+  active = 0;
+  buf = buffers[active].data();
+  count = 0;
+  done = false;
+  writer = std::thread(&TraceWriter::writer_loop, this);
+  return true;
+}
+
+void TraceWriter::flush(void) {
+  if (failed.load(std::memory_order_relaxed)) {
+    // tracing stopped. just make room
+    count = 0;
+    return;
+  }
+  std::unique_lock<std::mutex> lk(lock);
+  // only blocks if the writer is still busy with the other buffer
+  cv.wait(lk, [this] { return pending == nullptr; });
+  pending = buf;
+  pending_count = count;
+  entries_written += count;
+  cv.notify_all();
+
+  active ^= 1;
+  buf = buffers[active].data();
+  count = 0;
+}
+
+void TraceWriter::writer_loop(void) {
+  std::unique_lock<std::mutex> lk(lock);
+  while (true) {
+    cv.wait(lk, [this] { return pending != nullptr || done; });
+    if (pending != nullptr) {
+      const Trace_Entry *data = pending;
+      size_t n = pending_count;
+      lk.unlock();
+      if (!failed.load(std::memory_order_relaxed) &&
+          fwrite(data, sizeof(Trace_Entry), n, out) != n) {
+        fail();
+      }
+      lk.lock();
+      pending = nullptr;
+      cv.notify_all();
+    } else if (done) {
+      return;
+    }
+  }
+}
+
+void TraceWriter::fail(void) {
+  // a truncated trace would diff as if the run had ended there
+  if (!failed.exchange(true)) {
+    std::cerr << "GBcon: cpu trace to " << path << " stopped: "
+              << strerror(errno) << std::endl;
+  }
+}
+
+void TraceWriter::close(void) {
+  if (out == nullptr) {
+    return;
+  }
+  if (count) {
+    flush();
+  }
+  {
+    std::lock_guard<std::mutex> lk(lock);
+    done = true;
+  }
+  cv.notify_all();
+  writer.join();
+  if (fclose(out) != 0) {
+    fail();
+  }
+  out = nullptr;
+}
@@ -14,6 +14,19 @@ std::vector<std::string> split(const std::string &s, char delim) {
   return tokens;
 }
 
+// joins tokens[first, last) back together
+std::string join(const std::vector<std::string> &tokens, size_t first,
+                 size_t last, char delim) {
+  std::string s;
+  for (size_t i = first; i < last && i < tokens.size(); i++) {
+    if (i != first) {
+      s += delim;
+    }
+    s += tokens[i];
+  }
+  return s;
+}
+
 std::string get_console_line(void) {
   std::cin.clear();
   std::string s;
@@ -3,13 +3,22 @@
 #include "gb_lcd.h"
 #include "gb_sdl.h"
 #include "gb_cart.h"
+#include "gb_control.h"
 #include "gb_timer.h"
 #include "gb_int.h"
+#include "gb_joypad.h"
 #include "gb_memory.h"
+#include "gb_record.h"
+#include "gb_shm.h"
+#include "gb_state.h"
+#include "gb_trace.h"
+#include "gb_video.h"
 #include <fstream>
 #include <iostream>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <string>
+#include <csignal>
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -25,10 +34,18 @@ Memory mem;
 LCD lcd;
 Interrupt interrupt;
 Timer timer;
+Joypad joypad;
 Debug dbg;
 Cartridge *cart;
+TraceWriter cpu_trace;
+SaveState save_state;
+Recorder recorder;
+ShmExport shm;
+VideoBackend *video;
 
-string bios_path, rom_path, log_dir, dbg_flag, sav_path;
+string bios_path, rom_path, log_dir, dbg_flag, sav_path, cpu_trace_path,
+    input_script_path, record_input_path, record_path, shm_name,
+    control_path;
 
 void handle_emu_input(void) {
   /* save ram & load ram */
@@ -36,10 +53,106 @@ void handle_emu_input(void) {
     cart->export_sav(sav_path);
     emu_keys.save_ram = false;
   }
+  lcd.turbo = emu_keys.turbo;
+}
+
+// dump the execution trace before dying
+void crash_handler(int sig) {
+  cpu.dump_trace_fd(STDERR_FILENO);
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+// runs instructions until the LCD finishes a frame or the cpu stops. returns
+// true if the user quit
+bool run_frame(void) {
+  unsigned long frame = lcd.frames;
+  bool user_quit = false;
+  unsigned int clksLeft; // clock cycles -> 4.19Mhz
+  while (cpu.stop == false && lcd.frames == frame) {
+#ifdef GBCON_DEBUGGER
+    // drop into debugger on a breakpoint, step or watchpoint hit
+    if (dbg.attention || dbg.break_traps[cpu.registers.pc]) {
+      dbg.run();
+    }
+#endif
+
+    // save ram if pressed
+    handle_emu_input(); //FIXME - move out of main loop
+
+    // exec instruction and get num cycles taken
+    clksLeft = cpu.cpu_step();
+
+    // a halted cpu waits for an interrupt and only the PPU raises them. skip
+    // ahead to its next event
+    if (cpu.halted) {
+      unsigned int idle = lcd.cycles_to_next_event();
+      // or to the next key change, which can wake it too
+      unsigned long long now = lcd.cycle();
+      if (joypad.next_cycle < now + idle) {
+        idle = joypad.next_cycle > now ? joypad.next_cycle - now : 0;
+      }
+      if (idle > clksLeft) {
+        cpu.machine_cycle_counter += idle - clksLeft;
+        clksLeft = idle;
+      }
+    }
+
+    // step other subsystems (just LCD for now)
+    user_quit |= lcd.step(clksLeft);
+
+    // keys from the shared memory input slot, on real frames only so a
+    // rewind doesn't lose them
+    if (shm.active() && lcd.host_frame) {
+      shm.poll_input(&joypad, lcd.cycle());
+    }
+
+    // apply key changes that are due
+    joypad.step(lcd.cycle());
+
+    // check interrupts
+    interrupt.step();
+
+    // remap bootrom area to cartridge ram after 0x0100
+    if (cpu.registers.pc == 0x0100) {
+      mem.remapped_cart = true;
+    }
+  }
+  return user_quit;
+}
+
+void print_bench_results(std::chrono::duration<double> elapsed) {
+  double secs = elapsed.count();
+  std::cout << std::dec << std::fixed << std::setprecision(2)
+            << "GBcon: benchmark " << lcd.frames << " frames in " << secs
+            << " s\n"
+            << "  " << lcd.frames / secs << " fps ("
+            << lcd.frames / secs / lcd.refresh_rate_hz << "x realtime)\n"
+            << "  " << lcd.frames_unchanged << " unchanged frames not presented\n"
+            << "  " << cpu.ticks / secs / 1e6 << " M instructions/s"
+#ifdef GBCON_DEBUGGER
+            << "\n  debugger hooks: enabled" << std::endl;
+#else
+            << "\n  debugger hooks: compiled out" << std::endl;
+#endif
+}
+
+void print_speed_results(std::chrono::duration<double> elapsed) {
+  double secs = elapsed.count();
+  std::cout << std::dec << std::fixed << std::setprecision(2)
+            << "GBcon: " << lcd.frames << " frames in " << secs << " s ("
+            << lcd.frames / secs / lcd.refresh_rate_hz << "x speed)\n"
+            << "  " << lcd.frames_skipped << " frames skipped" << std::endl;
 }
 
 int main(int argc, char *argv[]) {
   int scale_factor;
+  string filter_name;
+  unsigned long bench_frames;
+  bool pace_stats;
+  bool present_thread;
+  bool headless;
+  unsigned int run_ahead;
 
   /** Parse command line arguements
    */
@@ -57,7 +170,37 @@ int main(int argc, char *argv[]) {
       ( "dbg,d", po::bool_switch(&dbg.stopped)->default_value(false), 
         "start emu in debugger")
       ("scale,s", po::value<int>(&scale_factor)->default_value(1),
-       "display scale. 1, 2, 4");
+       "display scale. 1-8")
+      ("filter", po::value<string>(&filter_name)->default_value("auto"),
+       "scaling: auto, sdl, nearest, scale2x, scale3x")
+      ("bench", po::value<unsigned long>(&bench_frames)->default_value(0),
+       "run N frames unthrottled and print emulation speed")
+      ("speed", po::value<double>(&lcd.Speed_Multi)->default_value(1.0),
+       "emulation speed multiple. 0 is unthrottled")
+      ("turbo-speed", po::value<double>(&lcd.turbo_speed)->default_value(4.0),
+       "speed while tab is held. 0 is unthrottled")
+      ("cpu-trace", po::value<string>(&cpu_trace_path),
+       "write binary cpu state trace to file (see GBtrace)")
+      ("render-thread", po::bool_switch(&lcd.threaded_render),
+       "draw frames on a worker thread (one frame of latency)")
+      ("present-thread", po::bool_switch(&present_thread),
+       "present frames and poll input on a separate thread")
+      ("headless", po::bool_switch(&headless),
+       "run without a window or pacing, as fast as possible")
+      ("input-script", po::value<string>(&input_script_path),
+       "keys to press by frame number (headless)")
+      ("record-input", po::value<string>(&record_input_path),
+       "write key changes to an input script")
+      ("record", po::value<string>(&record_path),
+       "record frames to file.y4m, file.png or |command")
+      ("shm", po::value<string>(&shm_name),
+       "publish frames and take keys in shared memory /dev/shm/NAME")
+      ("control", po::value<string>(&control_path),
+       "serve headless sessions on a Unix socket (see gb_control.h)")
+      ("run-ahead", po::value<unsigned int>(&run_ahead)->default_value(0),
+       "show the frame N frames ahead to hide input lag. 0-4")
+      ("pace-stats", po::bool_switch(&pace_stats),
+       "print frame pacing and speed stats on exit");
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -78,6 +221,38 @@ int main(int argc, char *argv[]) {
 
   sav_path = rom_path + ".sav";
 
+#ifndef GBCON_DEBUGGER
+  if (dbg.stopped) {
+    std::cerr << "GBcon: built without debugger support" << std::endl;
+    dbg.stopped = false;
+  }
+#endif
+
+  if (run_ahead > 4) {
+    std::cerr << "GBcon: run-ahead is limited to 4 frames" << std::endl;
+    run_ahead = 4;
+  }
+  // breakpoints, watchpoints and tracepoints would fire again in every
+  // thrown away frame
+  if (run_ahead && dbg.stopped) {
+    std::cerr << "GBcon: --run-ahead can't be used with --dbg" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // sessions are forked, so nothing may have started a thread or opened a
+  // file they would share
+  if (!control_path.empty()) {
+    if (lcd.threaded_render || !record_path.empty() ||
+        !cpu_trace_path.empty() || !shm_name.empty() ||
+        !record_input_path.empty() || run_ahead || dbg.stopped) {
+      std::cerr << "GBcon: --control can't be used with --render-thread, "
+                << "--record, --cpu-trace, --shm, --record-input, "
+                << "--run-ahead or --dbg" << std::endl;
+      return EXIT_FAILURE;
+    }
+    headless = true;
+  }
+
   /** GBcon code
    */
 
@@ -91,21 +266,56 @@ int main(int argc, char *argv[]) {
     mem.init_bios(bios_path);
   }
 
-  // initialize sdl after checking params
+  // initialize video after checking params
   Sdl_params sdl_p;
-  switch (scale_factor) {
-  case 1:
-  case 2:
-  case 4:
-    // supported scale factors
+  if (scale_factor >= 1 && scale_factor <= (int)Scaler::Max_Factor) {
     sdl_p.scale = scale_factor;
-    break;
-  default:
+  } else {
     std::cerr << "GBcon: unsupported scale factor " << scale_factor << std::endl;
     sdl_p.scale = 1;
-    break;
   }
-  sdl_init(sdl_p);
+  if (!Scaler::parse_filter(filter_name, &sdl_p.filter)) {
+    std::cerr << "GBcon: unknown filter " << filter_name << std::endl;
+    sdl_p.filter = Scaler::AUTO;
+  } else if (sdl_p.scale % Scaler::filter_factor(sdl_p.filter) != 0) {
+    std::cerr << "GBcon: " << filter_name << " needs a scale that's a "
+              << "multiple of " << Scaler::filter_factor(sdl_p.filter)
+              << std::endl;
+    sdl_p.filter = Scaler::NEAREST;
+  }
+  sdl_p.present_thread = present_thread;
+  NullBackend *null_video = nullptr;
+  if (headless) {
+    null_video = new NullBackend();
+    if (!input_script_path.empty() &&
+        !null_video->script.load(input_script_path)) {
+      return EXIT_FAILURE;
+    }
+    video = null_video;
+    lcd.throttle = false;
+  } else {
+    if (!input_script_path.empty()) {
+      std::cerr << "GBcon: --input-script needs --headless" << std::endl;
+    }
+    video = new SdlBackend(sdl_p);
+  }
+
+  if (!record_path.empty()) {
+    if (!recorder.open(record_path)) {
+      return EXIT_FAILURE;
+    }
+    lcd.recorder = &recorder;
+    // every frame goes into the recording, so draw them all
+    lcd.frame_skip = false;
+  }
+  if (!shm_name.empty()) {
+    if (!shm.open(shm_name)) {
+      return EXIT_FAILURE;
+    }
+    lcd.shm = &shm;
+    // every finished frame is published, so draw them all
+    lcd.frame_skip = false;
+  }
 
   // pass around pointers
   GB_Sys gb_sys;
@@ -116,51 +326,116 @@ int main(int argc, char *argv[]) {
   gb_sys.cart = cart;
   gb_sys.timer = &timer;
   gb_sys.dbg = &dbg;
+  gb_sys.video = video;
+  gb_sys.joypad = &joypad;
 
   cpu.init(&gb_sys);
   lcd.init(&gb_sys);
   interrupt.init(&gb_sys);
   mem.init(&gb_sys);
   timer.init(&gb_sys);
+  joypad.init(&gb_sys);
+  save_state.init(&gb_sys);
   dbg.init(&gb_sys);
 
+  if (null_video != nullptr) {
+    null_video->script.schedule(&joypad);
+  }
+  if (!record_input_path.empty() && !joypad.record(record_input_path)) {
+    return EXIT_FAILURE;
+  }
+
+  if (!cpu_trace_path.empty()) {
+    if (!cpu_trace.open(cpu_trace_path)) {
+      return EXIT_FAILURE;
+    }
+    cpu.trace_writer = &cpu_trace;
+  }
+
+  for (int sig : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+    signal(sig, crash_handler);
+  }
+
   // reset cpu, then loop
   cpu.reset();
 
+  if (bench_frames) {
+    lcd.throttle = false;
+    lcd.frame_skip = false;
+  }
+
+  if (!control_path.empty()) {
+    // every frame is drawn so the last one can be fetched
+    lcd.frame_skip = false;
+    ControlServer server;
+    if (!server.open(control_path)) {
+      return EXIT_FAILURE;
+    }
+    std::cout << "GBcon: serving sessions on " << control_path << std::endl;
+    server.run(&gb_sys, &save_state, run_frame);
+    server.close();
+    video->close();
+    delete video;
+    return 0;
+  }
+
+  auto start_time = std::chrono::steady_clock::now();
+
   bool user_quit = false;
-  unsigned int clksLeft; // clock cycles -> 4.19Mhz
   while (cpu.stop == false && user_quit == false) {
-    // drop into debugger
-    dbg.run();
+    if (run_ahead) {
+      // advance one real frame without showing it, then show the frame
+      // run_ahead frames later and rewind to the real one
+      lcd.draw_frames = false;
+      user_quit = run_frame();
+      save_state.save();
 
-    // save ram if pressed
-    handle_emu_input(); //FIXME - move out of main loop
-
-    // exec instruction and get num cycles taken
-    clksLeft = cpu.cpu_step();
+      TraceWriter *trace_writer = cpu.trace_writer;
+      cpu.trace_writer = nullptr;
+      lcd.host_frame = false;
+      joypad.recording = false;
+      cpu.trace_ring_on = false;
+      for (unsigned int i = 1; i <= run_ahead && !cpu.stop; i++) {
+        lcd.draw_frames = (i == run_ahead);
+        run_frame();
+      }
+      save_state.load();
+      lcd.host_frame = true;
+      joypad.recording = true;
+      cpu.trace_ring_on = true;
+      cpu.trace_writer = trace_writer;
+    } else {
+      user_quit = run_frame();
+    }
 
-    // step other subsystems (just LCD for now)
-    while (clksLeft) {
-      user_quit |= lcd.step(4);
-      clksLeft -= 4;
+    if (bench_frames && lcd.frames >= bench_frames) {
+      break;
     }
+  }
 
-    // check interrupts
-    interrupt.step();
+  lcd.close();
 
-    // remap bootrom area to cartridge ram after 0x0100
-    if (cpu.registers.pc == 0x0100) {
-      mem.remapped_cart = true;
-    }
+  if (bench_frames) {
+    print_bench_results(std::chrono::steady_clock::now() - start_time);
   }
+  if (pace_stats) {
+    print_speed_results(std::chrono::steady_clock::now() - start_time);
+    lcd.pacer.print_stats(std::cout);
+  }
+
+  recorder.close();
+  shm.close();
+  cpu_trace.close();
+  joypad.close(lcd.frames);
 
   if (!log_dir.empty()) {
     std::cout << "GBcon: writing logs to " << log_dir << std::endl;
     mem.print_to_file(log_dir + "/memdump.log");
-    dbg.write_serial_log_file(log_dir + "/serial.log");
+    mem.write_serial_log_file(log_dir + "/serial.log");
   }
 
-  sdl_uninit();
+  video->close();
+  delete video;
   return 0;
 }
 
@@ -0,0 +1,195 @@
+/* GBkernels - microbenchmark for the gb_simd pixel kernels
+
+   GBkernels [frames]
+       renders a frame's worth of background lines (20 tile rows decoded,
+       palette mapped and expanded to ARGB per line) with the old
+       per-pixel loops and with each kernel set the host supports, and
+       prints the time per frame. then times upscaling a frame with each
+       filter (4x nearest, Scale2x, Scale3x) against the scalar kernels
+*/
+#include "gb_simd.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const int Width = 160;
+static const int Height = 144;
+static const unsigned int Colors[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555,
+                                       0xFF000000};
+
+struct Frame {
+  unsigned char tiledata[Height][2 * Width / 8];
+  unsigned char palette;
+};
+
+// the loops GBcon used before the kernels: one pixel per iteration
+static void render_per_pixel(const Frame &f, unsigned int *out) {
+  unsigned char dot_palette[4];
+  for (int k = 0; k < 4; k++) {
+    dot_palette[k] = (f.palette >> (2 * k)) & 0x03;
+  }
+  unsigned char shades[Width];
+  for (int line = 0; line < Height; line++) {
+    for (int t = 0; t < Width / 8; t++) {
+      unsigned char msb = f.tiledata[line][2 * t];
+      unsigned char lsb = f.tiledata[line][2 * t + 1];
+      for (int j = 0; j < 8; j++) {
+        unsigned char mask = (0x80 >> j);
+        unsigned char pal_num = !!(msb & mask) + 2 * !!(lsb & mask);
+        shades[8 * t + j] = dot_palette[pal_num];
+      }
+    }
+    for (int x = 0; x < Width; x++) {
+      out[line * Width + x] = Colors[shades[x]];
+    }
+  }
+}
+
+static void render_kernels(const gb_simd::Kernels *k, const Frame &f,
+                           unsigned int *out) {
+  unsigned char colors[Width], shades[Width];
+  for (int line = 0; line < Height; line++) {
+    k->decode_tile_rows(f.tiledata[line], colors, Width / 8);
+    k->map_palette(colors, shades, Width, f.palette);
+    k->expand_argb(shades, &out[line * Width], Width, Colors);
+  }
+}
+
+// a frame with its edge pixels repeated one past each side, as the Scale2x
+// and Scale3x kernels read them
+struct Padded_Frame {
+  static const int Pitch = Width + 2;
+  std::vector<unsigned int> pixels =
+      std::vector<unsigned int>(Pitch * (Height + 2));
+  const unsigned int *row(int y) const {
+    y = y < 0 ? 0 : (y >= Height ? Height - 1 : y);
+    return &pixels[(y + 1) * Pitch + 1];
+  }
+};
+
+enum Scale_Filter { NEAREST_4X, SCALE2X, SCALE3X };
+static const char *Scale_Filter_Names[] = {"4x", "scale2x", "scale3x"};
+static const int Scale_Factors[] = {4, 2, 3};
+
+static void scale_frame(const gb_simd::Kernels *k, Scale_Filter filter,
+                        const Padded_Frame &f, unsigned int *out) {
+  int factor = Scale_Factors[filter];
+  int pitch = Width * factor;
+  for (int y = 0; y < Height; y++) {
+    unsigned int *rows[4];
+    for (int r = 0; r < factor; r++) {
+      rows[r] = &out[(y * factor + r) * pitch];
+    }
+    switch (filter) {
+    case NEAREST_4X:
+      k->scale_row(f.row(y), rows[0], Width, factor);
+      for (int r = 1; r < factor; r++) {
+        memcpy(rows[r], rows[0], pitch * sizeof(unsigned int));
+      }
+      break;
+    case SCALE2X:
+      k->scale2x_row(f.row(y - 1), f.row(y), f.row(y + 1), rows, Width);
+      break;
+    case SCALE3X:
+      k->scale3x_row(f.row(y - 1), f.row(y), f.row(y + 1), rows, Width);
+      break;
+    }
+  }
+}
+
+template <typename F> static double time_ns_per_frame(int frames, F render) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    render();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / frames;
+}
+
+int main(int argc, char *argv[]) {
+  int frames = argc > 1 ? atoi(argv[1]) : 20000;
+  if (frames <= 0) {
+    fprintf(stderr, "usage: GBkernels [frames]\n");
+    return EXIT_FAILURE;
+  }
+
+  Frame frame;
+  std::mt19937 rng(1);
+  for (auto &row : frame.tiledata) {
+    for (auto &b : row) {
+      b = rng();
+    }
+  }
+  frame.palette = 0xE4;
+
+  std::vector<unsigned int> expected(Width * Height), out(Width * Height);
+  double base = time_ns_per_frame(frames, [&] {
+    render_per_pixel(frame, expected.data());
+  });
+  printf("%-10s %10.0f ns/frame\n", "per-pixel", base);
+
+  const gb_simd::Isa isas[] = {gb_simd::SCALAR, gb_simd::SSE2, gb_simd::AVX2};
+  for (gb_simd::Isa isa : isas) {
+    const gb_simd::Kernels *k = gb_simd::get_kernels(isa);
+    if (k == nullptr) {
+      continue;
+    }
+    double ns = time_ns_per_frame(frames, [&] {
+      render_kernels(k, frame, out.data());
+    });
+    bool same = memcmp(out.data(), expected.data(),
+                       out.size() * sizeof(unsigned int)) == 0;
+    printf("%-10s %10.0f ns/frame  %5.2fx%s%s\n", k->name, ns, base / ns,
+           k == gb_simd::kernels ? "  (selected)" : "",
+           same ? "" : "  OUTPUT MISMATCH");
+  }
+
+  // blocky picture with plenty of equal neighbours, so the filters' edge
+  // rules all get exercised
+  Padded_Frame padded;
+  for (int y = -1; y <= Height; y++) {
+    for (int x = -1; x <= Width; x++) {
+      unsigned int &p = padded.pixels[(y + 1) * Padded_Frame::Pitch + x + 1];
+      switch (rng() % 4) {
+      case 0:
+        p = Colors[rng() % 4];
+        break;
+      case 1:
+      case 2:
+        p = x > -1 ? (&p)[-1] : Colors[0];
+        break;
+      default:
+        p = y > -1 ? (&p)[-Padded_Frame::Pitch] : Colors[0];
+        break;
+      }
+    }
+  }
+
+  std::vector<unsigned int> scaled_expected(Width * Height * 16),
+      scaled(Width * Height * 16);
+  const gb_simd::Kernels *scalar = gb_simd::get_kernels(gb_simd::SCALAR);
+  for (Scale_Filter filter : {NEAREST_4X, SCALE2X, SCALE3X}) {
+    size_t n = Width * Height * Scale_Factors[filter] * Scale_Factors[filter];
+    double scalar_ns = time_ns_per_frame(frames / 10 + 1, [&] {
+      scale_frame(scalar, filter, padded, scaled_expected.data());
+    });
+    for (gb_simd::Isa isa : isas) {
+      const gb_simd::Kernels *k = gb_simd::get_kernels(isa);
+      if (k == nullptr) {
+        continue;
+      }
+      double ns = time_ns_per_frame(frames / 10 + 1, [&] {
+        scale_frame(k, filter, padded, scaled.data());
+      });
+      bool same = memcmp(scaled.data(), scaled_expected.data(),
+                         n * sizeof(unsigned int)) == 0;
+      printf("%-8s %-6s %10.0f ns/frame  %5.2fx%s\n",
+             Scale_Filter_Names[filter], k->name, ns, scalar_ns / ns,
+             same ? "" : "  OUTPUT MISMATCH");
+    }
+  }
+  return EXIT_SUCCESS;
+}
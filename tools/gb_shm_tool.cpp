@@ -0,0 +1,227 @@
+/* GBshm - client for GBcon --shm NAME (see gb_shm.h)
+
+   GBshm watch NAME [frames]
+       wait for frames as they're published and print each one's frame
+       number, emulated clock and how long after publishing it arrived.
+       stops after frames frames (default: until GBcon exits)
+   GBshm grab NAME out.ppm
+       write the next frame to a PPM image
+   GBshm keys NAME [keys...]
+       hold keys (a b select start right left up down) until the next
+       keys command. no keys holds none, and "off" gives input back to
+       GBcon's own
+*/
+#include "gb_shm.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char *Key_Names[8] = {"a",     "b",    "select", "start",
+                                   "right", "left", "up",     "down"};
+
+static uint64_t now_ns(void) {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// maps an existing segment and checks it's one of ours
+static Shm_Header *open_segment(std::string name) {
+  if (name.empty() || name[0] != '/') {
+    name = "/" + name;
+  }
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    std::cerr << "GBshm: can't open " << name << ": " << strerror(errno)
+              << std::endl;
+    return nullptr;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Shm_Header)) {
+    p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    std::cerr << "GBshm: can't map " << name << std::endl;
+    return nullptr;
+  }
+  Shm_Header *header = (Shm_Header *)p;
+  if (memcmp(header->magic, Shm_Magic, sizeof(Shm_Magic)) != 0 ||
+      header->version != Shm_Version ||
+      header->frame_offset + (uint64_t)header->slots * header->frame_size >
+          (uint64_t)st.st_size) {
+    std::cerr << "GBshm: " << name << " isn't a GBcon segment" << std::endl;
+    return nullptr;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return header;
+}
+
+// blocks until more than seen frames are published. false if GBcon is gone
+static bool wait_frame(Shm_Header *header, uint32_t seen) {
+  while (header->published.load(std::memory_order_acquire) == seen) {
+    if (kill(header->pid, 0) != 0 && errno == ESRCH) {
+      return false;
+    }
+    header->waiters.fetch_add(1, std::memory_order_seq_cst);
+    // the kernel rechecks published, so a frame published since the load
+    // above doesn't get slept through. the timeout notices GBcon exiting
+    timespec timeout = {0, 200000000};
+    syscall(SYS_futex, &header->published, FUTEX_WAIT, seen, &timeout,
+            nullptr, 0);
+    header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+  }
+  return true;
+}
+
+// copies the newest frame out. false if the writer got to it first
+static bool read_frame(Shm_Header *header, Shm_Frame *out) {
+  uint32_t n = header->published.load(std::memory_order_acquire);
+  if (n == 0) {
+    return false;
+  }
+  const Shm_Frame *slot =
+      (const Shm_Frame *)((const char *)header + header->frame_offset +
+                          ((n - 1) % header->slots) * header->frame_size);
+  uint32_t seq = slot->seq.load(std::memory_order_acquire);
+  if (seq & 1) {
+    return false;
+  }
+  out->frame = slot->frame;
+  out->cycle = slot->cycle;
+  out->host_ns = slot->host_ns;
+  memcpy(out->pixels, slot->pixels, sizeof(out->pixels));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot->seq.load(std::memory_order_relaxed) == seq;
+}
+
+static int watch(Shm_Header *header, unsigned long count) {
+  static Shm_Frame frame;
+  uint32_t seen = header->published.load(std::memory_order_acquire);
+  unsigned long frames = 0, torn = 0;
+  uint64_t last_frame = 0;
+  while (count == 0 || frames < count) {
+    if (!wait_frame(header, seen)) {
+      break;
+    }
+    seen = header->published.load(std::memory_order_acquire);
+    if (!read_frame(header, &frame)) {
+      torn++;
+      continue;
+    }
+    uint64_t latency = now_ns() - frame.host_ns;
+    printf("frame %8llu  cycle %12llu  %6.1f us",
+           (unsigned long long)frame.frame, (unsigned long long)frame.cycle,
+           latency / 1000.0);
+    if (frames > 0 && frame.frame > last_frame + 1) {
+      printf("  (%llu missed)",
+             (unsigned long long)(frame.frame - last_frame - 1));
+    }
+    printf("\n");
+    last_frame = frame.frame;
+    frames++;
+  }
+  fflush(stdout);
+  std::cerr << "GBshm: " << frames << " frames";
+  if (torn) {
+    std::cerr << ", " << torn << " overwritten while reading";
+  }
+  std::cerr << std::endl;
+  return EXIT_SUCCESS;
+}
+
+static int grab(Shm_Header *header, const char *path) {
+  static Shm_Frame frame;
+  do {
+    if (!wait_frame(header,
+                    header->published.load(std::memory_order_acquire))) {
+      std::cerr << "GBshm: GBcon exited" << std::endl;
+      return EXIT_FAILURE;
+    }
+  } while (!read_frame(header, &frame));
+
+  FILE *out = fopen(path, "wb");
+  if (out == nullptr) {
+    std::cerr << "GBshm: can't write " << path << std::endl;
+    return EXIT_FAILURE;
+  }
+  fprintf(out, "P6\n%u %u\n255\n", Shm_Width, Shm_Height);
+  for (uint32_t argb : frame.pixels) {
+    unsigned char rgb[3] = {(unsigned char)(argb >> 16),
+                            (unsigned char)(argb >> 8), (unsigned char)argb};
+    fwrite(rgb, 1, sizeof(rgb), out);
+  }
+  fclose(out);
+  std::cerr << "GBshm: frame " << frame.frame << " written to " << path
+            << std::endl;
+  return EXIT_SUCCESS;
+}
+
+static int keys(Shm_Header *header, int argc, char *argv[]) {
+  uint32_t input = Shm_Input_Active;
+  for (int i = 0; i < argc; i++) {
+    std::string key = argv[i];
+    if (key == "off") {
+      input = 0;
+      break;
+    }
+    unsigned int bit = 0;
+    while (bit < 8 && key != Key_Names[bit]) {
+      bit++;
+    }
+    if (bit == 8) {
+      std::cerr << "GBshm: unknown key " << key << std::endl;
+      return EXIT_FAILURE;
+    }
+    input |= 1u << bit;
+  }
+  header->input.store(input, std::memory_order_relaxed);
+  return EXIT_SUCCESS;
+}
+
+static void usage(void) {
+  std::cerr << "usage: GBshm watch NAME [frames]\n"
+            << "       GBshm grab NAME out.ppm\n"
+            << "       GBshm keys NAME [a b select start right left up down"
+            << " | off]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  std::string command = argv[1];
+  if (command != "watch" && command != "grab" && command != "keys") {
+    usage();
+    return EXIT_FAILURE;
+  }
+  Shm_Header *header = open_segment(argv[2]);
+  if (header == nullptr) {
+    return EXIT_FAILURE;
+  }
+  if (command == "watch") {
+    return watch(header, argc > 3 ? std::stoul(argv[3]) : 0);
+  }
+  if (command == "grab" && argc == 4) {
+    return grab(header, argv[3]);
+  }
+  if (command == "keys") {
+    return keys(header, argc - 3, argv + 3);
+  }
+  usage();
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,185 @@
+/* GBtrace - offline companion to GBcon --cpu-trace
+
+   GBtrace convert <trace> [out.txt]
+       write a trace as gameboy-doctor text lines (stdout if no out file)
+   GBtrace diff <trace a> <trace b> [-c lines] [-s pc]
+       report the first instruction where the two traces disagree, with
+       the preceding lines for context. either trace may be a GBcon binary
+       trace or a gameboy-doctor text log. -s skips each trace forward to
+       the first instruction at pc (e.g. 0x100 to skip the boot rom)
+*/
+#include "gb_trace.h"
+#include <boost/circular_buffer.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// streams entries out of a binary trace or a doctor text log
+class TraceReader {
+public:
+  bool open(const std::string &path) {
+    in = fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+      std::cerr << "GBtrace: could not open " << path << std::endl;
+      return false;
+    }
+    setvbuf(in, nullptr, _IOFBF, 1 << 22);
+    char magic[sizeof(Trace_Magic)];
+    binary = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+             memcmp(magic, Trace_Magic, sizeof(magic)) == 0;
+    if (!binary) {
+      rewind(in);
+    }
+    return true;
+  }
+
+  ~TraceReader() {
+    if (in) {
+      fclose(in);
+    }
+  }
+
+  bool next(Trace_Entry &e) {
+    if (binary) {
+      return fread(&e, sizeof(e), 1, in) == 1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), in)) {
+      if (parse_doctor_line(line, e)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // skip forward to the first entry at pc. leaves it in e
+  bool seek_pc(unsigned short pc, Trace_Entry &e) {
+    while (next(e)) {
+      if (e.pc == pc) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  FILE *in = nullptr;
+  bool binary = false;
+};
+
+static void print_entry(const char *prefix, unsigned long long n,
+                        const Trace_Entry &e) {
+  char line[128];
+  format_doctor_line(line, sizeof(line), e);
+  printf("%s%12llu  %s\n", prefix, n, line);
+}
+
+static int convert(const std::string &in_path, const char *out_path) {
+  TraceReader reader;
+  if (!reader.open(in_path)) {
+    return EXIT_FAILURE;
+  }
+  FILE *out = out_path ? fopen(out_path, "w") : stdout;
+  if (out == nullptr) {
+    std::cerr << "GBtrace: could not open " << out_path << std::endl;
+    return EXIT_FAILURE;
+  }
+  setvbuf(out, nullptr, _IOFBF, 1 << 22);
+
+  Trace_Entry e;
+  char line[128];
+  while (reader.next(e)) {
+    int n = format_doctor_line(line, sizeof(line) - 1, e);
+    line[n] = '\n';
+    fwrite(line, 1, n + 1, out);
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  return EXIT_SUCCESS;
+}
+
+static int diff(const std::string &a_path, const std::string &b_path,
+                size_t context, long sync_pc) {
+  TraceReader a, b;
+  if (!a.open(a_path) || !b.open(b_path)) {
+    return EXIT_FAILURE;
+  }
+
+  Trace_Entry ea, eb;
+  bool have_a, have_b;
+  if (sync_pc >= 0) {
+    have_a = a.seek_pc(sync_pc, ea);
+    have_b = b.seek_pc(sync_pc, eb);
+  } else {
+    have_a = a.next(ea);
+    have_b = b.next(eb);
+  }
+
+  boost::circular_buffer<Trace_Entry> history(context);
+  unsigned long long n = 0;
+  while (have_a && have_b) {
+    if (memcmp(&ea, &eb, sizeof(Trace_Entry)) != 0) {
+      printf("first divergence at instruction %llu\n", n);
+      unsigned long long first = n - history.size();
+      for (auto &h : history) {
+        print_entry("  ", first++, h);
+      }
+      print_entry("a ", n, ea);
+      print_entry("b ", n, eb);
+
+      printf("differs in:");
+      const char *names[] = {"A", "F", "B", "C", "D", "E", "H", "L"};
+      const unsigned char *ra = &ea.a, *rb = &eb.a;
+      for (int i = 0; i < 8; i++) {
+        if (ra[i] != rb[i]) {
+          printf(" %s", names[i]);
+        }
+      }
+      if (ea.sp != eb.sp) printf(" SP");
+      if (ea.pc != eb.pc) printf(" PC");
+      if (memcmp(ea.pcmem, eb.pcmem, sizeof(ea.pcmem))) printf(" PCMEM");
+      printf("\n");
+      return 1;
+    }
+    history.push_back(ea);
+    n++;
+    have_a = a.next(ea);
+    have_b = b.next(eb);
+  }
+
+  if (have_a != have_b) {
+    printf("traces match for %llu instructions, then %s ends\n", n,
+           have_a ? "b" : "a");
+    return 1;
+  }
+  printf("traces match (%llu instructions)\n", n);
+  return 0;
+}
+
+static void usage(void) {
+  std::cerr << "usage: GBtrace convert <trace> [out.txt]\n"
+            << "       GBtrace diff <trace a> <trace b> [-c lines] [-s pc]"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 3 && std::string(argv[1]) == "convert") {
+    return convert(argv[2], argc > 3 ? argv[3] : nullptr);
+  }
+  if (argc >= 4 && std::string(argv[1]) == "diff") {
+    size_t context = 10;
+    long sync_pc = -1;
+    for (int i = 4; i + 1 < argc; i += 2) {
+      if (std::string(argv[i]) == "-c") {
+        context = std::stoul(argv[i + 1], nullptr, 0);
+      } else if (std::string(argv[i]) == "-s") {
+        sync_pc = std::stol(argv[i + 1], nullptr, 0);
+      }
+    }
+    return diff(argv[2], argv[3], context, sync_pc);
+  }
+  usage();
+  return EXIT_FAILURE;
+}